@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+
+#include "model.h"
+#include "src/include/rasterizer.h"
+#include "src/include/threads.h"
+
+#define BENCH_WIDTH 1920
+#define BENCH_HEIGHT 1080
+
+/**
+ * Synthetic (or loaded) scene which is rendered every frame of a benchmark
+ */
+typedef struct {
+    const char* name;
+    Mesh mesh;
+    unsigned int turntable;
+} Scene;
+
+/**
+ * Measured results of a single scene
+ */
+typedef struct {
+    double* frameTimes;
+    RasterStats stats;
+} Result;
+
+static unsigned int seed = 1;
+
+/**
+ * Linear congruential generator, the benchmark does not rely on rand() to stay reproducible across platforms
+ *
+ * @return Random value in the range of 0 to 1
+ */
+static float randomFloat(void) {
+    seed = seed * 1664525u + 1013904223u;
+    return (float)(seed >> 8) / (float)(1u << 24);
+}
+
+/**
+ * Inverse of the raster space mapping of the rasterizer, used to place synthetic triangles in pixel coordinates
+ *
+ * @param x Raster x coordinate
+ * @param y Raster y coordinate
+ * @param depth Distance to the camera
+ * @return Vector in camera space
+ */
+static Vector3 rasterToCamera(float x, float y, float depth) {
+    float wAspect;
+    float hAspect;
+    viewAspect(DEVICE_ASPECT, BENCH_WIDTH, BENCH_HEIGHT, &wAspect, &hAspect);
+
+    return (Vector3) {
+        .x = (x / (.5f * BENCH_WIDTH) - 1) * depth / (NEAR_CLIPPING * wAspect),
+        .y = (1 - y / (.5f * BENCH_HEIGHT)) * depth / (NEAR_CLIPPING * hAspect),
+        .z = -depth
+    };
+}
+
+static void initMesh(Mesh* mesh, unsigned int triangleCount) {
+    mesh->vertexCount = 0;
+    mesh->indicesCount = 0;
+    mesh->vertices = malloc(triangleCount * 3 * sizeof(Vector3));
+    mesh->indices = malloc(triangleCount * 3 * sizeof(unsigned int));
+}
+
+/**
+ * Append a triangle given in raster coordinates, the winding is corrected to be front facing
+ */
+static void addTriangle(Mesh* mesh, float x0, float y0, float x1, float y1, float x2, float y2, float depth) {
+    Vector3 r[3] = { { x0, y0, 0 }, { x1, y1, 0 }, { x2, y2, 0 } };
+    if (edgeFunction(&r[0], &r[1], &r[2]) < 0) {
+        Vector3 swap = r[1];
+        r[1] = r[2];
+        r[2] = swap;
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        mesh->vertices[mesh->vertexCount] = rasterToCamera(r[i].x, r[i].y, depth);
+        mesh->indices[mesh->indicesCount++] = ++mesh->vertexCount;
+    }
+}
+
+static void tinyTriangles(Scene* scene) {
+    unsigned int count = 200000;
+    scene->name = "tiny";
+    initMesh(&scene->mesh, count);
+
+    for (unsigned int i = 0; i < count; ++i) {
+        float x = randomFloat() * (BENCH_WIDTH - 3);
+        float y = randomFloat() * (BENCH_HEIGHT - 3);
+        addTriangle(&scene->mesh,
+            x, y,
+            x + randomFloat() * 3, y + randomFloat() * 3,
+            x + randomFloat() * 3, y + randomFloat() * 3,
+            2 + randomFloat() * 10);
+    }
+}
+
+static void hugeTriangles(Scene* scene) {
+    unsigned int count = 16;
+    scene->name = "huge";
+    initMesh(&scene->mesh, count);
+
+    for (unsigned int i = 0; i < count; ++i) {
+        addTriangle(&scene->mesh,
+            -randomFloat() * BENCH_WIDTH, -randomFloat() * BENCH_HEIGHT,
+            BENCH_WIDTH * (1 + randomFloat()), BENCH_HEIGHT * randomFloat(),
+            BENCH_WIDTH * randomFloat(), BENCH_HEIGHT * (1 + randomFloat()),
+            2 + randomFloat() * 10);
+    }
+}
+
+static void overdraw(Scene* scene) {
+    unsigned int layers = 8;
+    scene->name = "overdraw";
+    initMesh(&scene->mesh, layers * 2);
+
+    // Screen filling quads drawn back to front, every layer passes the depth test
+    for (unsigned int i = 0; i < layers; ++i) {
+        float depth = 50 - (float)i;
+        addTriangle(&scene->mesh, 0, 0, BENCH_WIDTH, 0, 0, BENCH_HEIGHT, depth);
+        addTriangle(&scene->mesh, BENCH_WIDTH, 0, BENCH_WIDTH, BENCH_HEIGHT, 0, BENCH_HEIGHT, depth);
+    }
+}
+
+static void slivers(Scene* scene) {
+    unsigned int count = 500;
+    scene->name = "sliver";
+    initMesh(&scene->mesh, count);
+
+    // Long diagonal triangles of a couple of pixels wide
+    for (unsigned int i = 0; i < count; ++i) {
+        float x = randomFloat() * BENCH_WIDTH;
+        float y = randomFloat() * BENCH_HEIGHT;
+        float dx = (randomFloat() - .5f) * BENCH_WIDTH;
+        float dy = (randomFloat() - .5f) * BENCH_HEIGHT;
+        float width = 1 + randomFloat() * 2;
+        addTriangle(&scene->mesh, x, y, x + dx, y + dy, x + dx + width, y + dy + width, 2 + randomFloat() * 10);
+    }
+}
+
+static Matrix4x4 sceneMatrix(const Scene* scene, unsigned int frame, unsigned int frameCount) {
+    if (!scene->turntable)
+        return (Matrix4x4) { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { 0, 0, 0, 1 } };
+
+    float angle = 6.2831853f * (float)frame / (float)frameCount;
+    return (Matrix4x4) {
+        { cosf(angle), 0, sinf(angle), 0 },
+        { 0, 1, 0, 0 },
+        { -sinf(angle), 0, cosf(angle), 0 },
+        { 0, -.6f, -4, 1 }
+    };
+}
+
+static int compareTimes(const void* a, const void* b) {
+    double t1 = *(const double*)a;
+    double t2 = *(const double*)b;
+    return (t1 > t2) - (t1 < t2);
+}
+
+static double percentile(const double* sorted, unsigned int count, double p) {
+    unsigned int i = (unsigned int)(p * (count - 1) + .5);
+    return sorted[MIN(i, count - 1)];
+}
+
+static void runScene(const Scene* scene, const RenderTarget* target, unsigned int frameCount, unsigned int threadCount, DrawMode mode, const PipelineState* state, Result* result) {
+    // A single warm up frame
+    Instance instance = { &scene->mesh, sceneMatrix(scene, 0, frameCount) };
+    DrawList drawList = { &instance, 1, threadCount, NULL, mode, state };
+    clearRenderTarget(target);
+    drawInstances(target, &drawList);
+
+    for (unsigned int i = 0; i < frameCount; ++i) {
+        instance.modelViewProjection = sceneMatrix(scene, i, frameCount);
+
+        double start = timerSeconds();
+        clearRenderTarget(target);
+        drawInstances(target, &drawList);
+        result->frameTimes[i] = timerSeconds() - start;
+    }
+
+    // The statistics are collected in a separate pass, to keep their overhead out of the timings
+    memset(&result->stats, 0, sizeof(RasterStats));
+    drawList.stats = &result->stats;
+
+    for (unsigned int i = 0; i < frameCount; ++i) {
+        instance.modelViewProjection = sceneMatrix(scene, i, frameCount);
+        clearRenderTarget(target);
+        drawInstances(target, &drawList);
+    }
+}
+
+static void printResult(const Scene* scene, const Result* result, unsigned int frameCount) {
+    double total = 0;
+    for (unsigned int i = 0; i < frameCount; ++i) { total += result->frameTimes[i]; }
+    qsort(result->frameTimes, frameCount, sizeof(double), compareTimes);
+
+    double triangles = (double)(scene->mesh.indicesCount / 3) * frameCount;
+    double pixels = (double)result->stats.pixelsInside;
+    double tested = (double)result->stats.pixelsTested;
+
+    printf("%-10s %10u %9.3f %9.3f %9.3f %9.3f %10.2f %10.2f %8.3f %7.1f\n",
+        scene->name,
+        scene->mesh.indicesCount / 3,
+        percentile(result->frameTimes, frameCount, .5) * 1e3,
+        percentile(result->frameTimes, frameCount, .9) * 1e3,
+        percentile(result->frameTimes, frameCount, .99) * 1e3,
+        result->frameTimes[frameCount - 1] * 1e3,
+        triangles / total * 1e-6,
+        pixels / total * 1e-6,
+        pixels > 0 ? total / pixels * 1e9 : 0,
+        tested > 0 ? (1 - pixels / tested) * 100 : 0);
+}
+
+/**
+ * Parse a count argument
+ *
+ * @param argument Argument to parse, has to consist of decimal digits only
+ * @param count Destination of the count
+ * @return Zero when the argument is not a count, otherwise non zero
+ */
+static int parseCount(const char* argument, unsigned int* count) {
+    char* end;
+    unsigned long value = strtoul(argument, &end, 10);
+    if (argument[0] < '0' || argument[0] > '9' || *end != '\0' || value > UINT_MAX)
+        return 0;
+
+    *count = (unsigned int)value;
+    return 1;
+}
+
+/**
+ * Find an argument in a list of names
+ *
+ * @param argument Argument to find
+ * @param names Accepted names
+ * @param nameCount Count of names
+ * @return Index of the name, -1 when the argument is not accepted
+ */
+static int parseChoice(const char* argument, const char* const* names, int nameCount) {
+    for (int i = 0; i < nameCount; ++i) {
+        if (strcmp(argument, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * Benchmark the rasterizer using a set of reproducible scenes
+ *
+ * Usage: rasterizer-bench [frames] [threads] [scene|all] [linear|tiled] [float32|unorm16|unorm24] [samples] [direct|tiled|discard]
+ *                         [default|depth|flat|gouraud|pixel]
+ *
+ * At least one frame is drawn and the samples are 1, 4 or 8 per pixel. Invalid or additional arguments print the
+ * usage and exit with an error.
+ */
+int main(int argc, char** argv) {
+    static const char* const SCENE_NAMES[] = { "all", "tiny", "huge", "overdraw", "sliver", "turntable" };
+    static const char* const LAYOUT_NAMES[] = { "linear", "tiled" };
+    static const TargetLayout LAYOUTS[] = { TARGET_LAYOUT_LINEAR, TARGET_LAYOUT_TILED };
+    static const char* const DEPTH_NAMES[] = { "float32", "unorm16", "unorm24" };
+    static const DepthFormat DEPTH_FORMATS[] = { DEPTH_FORMAT_FLOAT32, DEPTH_FORMAT_UNORM16, DEPTH_FORMAT_UNORM24 };
+    static const char* const MODE_NAMES[] = { "direct", "tiled", "discard" };
+    static const DrawMode MODES[] = { DRAW_MODE_DIRECT, DRAW_MODE_TILED, DRAW_MODE_TILED_DISCARD_DEPTH };
+    static const char* const SHADE_NAMES[] = { "default", "depth", "flat", "gouraud", "pixel" };
+    static const ShadeMode SHADE_MODES[] = { SHADE_MODE_DEFAULT, SHADE_MODE_DEPTH_ONLY, SHADE_MODE_FLAT, SHADE_MODE_GOURAUD, SHADE_MODE_PIXEL };
+
+    unsigned int frameCount = 20;
+    unsigned int threadCount = 0;
+    unsigned int sampleCount = 1;
+    int sceneIndex = 0, layoutIndex = 0, depthIndex = 0, modeIndex = 0, shadeIndex = 0;
+
+    int valid = argc <= 9;
+    valid = valid && (argc <= 1 || (parseCount(argv[1], &frameCount) && frameCount >= 1));
+    valid = valid && (argc <= 2 || parseCount(argv[2], &threadCount));
+    valid = valid && (argc <= 3 || (sceneIndex = parseChoice(argv[3], SCENE_NAMES, 6)) >= 0);
+    valid = valid && (argc <= 4 || (layoutIndex = parseChoice(argv[4], LAYOUT_NAMES, 2)) >= 0);
+    valid = valid && (argc <= 5 || (depthIndex = parseChoice(argv[5], DEPTH_NAMES, 3)) >= 0);
+    valid = valid && (argc <= 6 || (parseCount(argv[6], &sampleCount) && (sampleCount == 1 || sampleCount == 4 || sampleCount == 8)));
+    valid = valid && (argc <= 7 || (modeIndex = parseChoice(argv[7], MODE_NAMES, 3)) >= 0);
+    valid = valid && (argc <= 8 || (shadeIndex = parseChoice(argv[8], SHADE_NAMES, 5)) >= 0);
+
+    if (!valid) {
+        printf("Usage: rasterizer-bench [frames] [threads] [scene|all] [linear|tiled] [float32|unorm16|unorm24] [samples]"
+            " [direct|tiled|discard] [default|depth|flat|gouraud|pixel]\n");
+        printf("Scenes: tiny, huge, overdraw, sliver, turntable\n");
+        return 1;
+    }
+
+    const char* filter = sceneIndex > 0 ? SCENE_NAMES[sceneIndex] : NULL;
+    TargetLayout layout = LAYOUTS[layoutIndex];
+    DepthFormat depthFormat = DEPTH_FORMATS[depthIndex];
+    DrawMode mode = MODES[modeIndex];
+    const char* depthName = DEPTH_NAMES[depthIndex];
+    const char* modeName = MODE_NAMES[modeIndex];
+    const char* shadeName = SHADE_NAMES[shadeIndex];
+    PipelineState state = defaultPipelineState();
+    state.shadeMode = SHADE_MODES[shadeIndex];
+
+    Scene scenes[5];
+    unsigned int sceneCount = 0;
+
+    memset(scenes, 0, sizeof(scenes));
+    tinyTriangles(&scenes[sceneCount++]);
+    hugeTriangles(&scenes[sceneCount++]);
+    overdraw(&scenes[sceneCount++]);
+    slivers(&scenes[sceneCount++]);
+
+    scenes[sceneCount].name = "turntable";
+    scenes[sceneCount].turntable = 1;
+    if (loadModel("../res/vector.obj", &scenes[sceneCount].mesh))
+        sceneCount++;
+    else
+        printf("Could not load ../res/vector.obj, skipping turntable\n");
+
+    RenderTarget target = createRenderTarget(BENCH_WIDTH, BENCH_HEIGHT, COLOR_FORMAT_GRAY8, depthFormat, layout, sampleCount, 0);
+
+    Result result = { malloc(frameCount * sizeof(double)) };
+
+    printf("%ux%u %s %s %ux %s %s, %u frames, %u threads\n", BENCH_WIDTH, BENCH_HEIGHT,
+        layout == TARGET_LAYOUT_TILED ? "tiled" : "linear", depthName, target.sampleCount, modeName, shadeName, frameCount, threadCount);
+    printf("%-10s %10s %9s %9s %9s %9s %10s %10s %8s %7s\n",
+        "scene", "tris", "p50 ms", "p90 ms", "p99 ms", "max ms", "Mtris/s", "Mpix/s", "ns/pix", "waste%");
+
+    for (unsigned int i = 0; i < sceneCount; ++i) {
+        if (filter == NULL || strcmp(filter, scenes[i].name) == 0) {
+            runScene(&scenes[i], &target, frameCount, threadCount, mode, &state, &result);
+            printResult(&scenes[i], &result, frameCount);
+        }
+        freeModel(&scenes[i].mesh);
+    }
+
+    free(result.frameTimes);
+    freeRenderTarget(&target);
+    return 0;
+}
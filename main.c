@@ -1,60 +1,125 @@
 #include <stdlib.h>
+#include <string.h>
 #include <memory.h>
-#include <objpar.h>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
 
+#include "model.h"
 #include "src/include/rasterizer.h"
+#include "src/include/lod.h"
+#include "src/include/processes.h"
+#include "src/include/imagefile.h"
 
-void* openFile(const char* p_file_name, size_t* p_file_size)
-{
-    FILE* p_file;
-    void* p_file_data;
-    size_t size;
-    int err;
-
-#if defined(_MSC_VER)
-    fopen_s(&p_file, p_file_name, "rb");
-#else
-    p_file = fopen(p_file_name, "rb+");
-#endif
-    assert(p_file != NULL);
-    fseek(p_file, 0L, SEEK_END);
-    size = ftell(p_file);
-    rewind(p_file);
-    p_file_data = malloc(size);
-#if defined(_MSC_VER)
-    fread_s(p_file_data, size, size, 1, p_file);
-#else
-    fread(p_file_data, size, 1, p_file);
-#endif
-    err = ferror(p_file);
-    assert(err == 0);
-    fclose(p_file);
-    *p_file_size = size;
-    return p_file_data;
+/**
+ * Write per pixel counters to an image using a black, blue, red and white color ramp
+ *
+ * The ramp is scaled to the highest counter in the image, which is printed for reference.
+ *
+ * @param fileName Path of the image
+ * @param counts Per pixel counters
+ * @param width Width of the image in pixels
+ * @param height Height of the image in pixels
+ */
+static void writeHeatmap(const char* fileName, const unsigned int* counts, int width, int height) {
+    int size = width * height;
+
+    unsigned int max = 1;
+    for (int i = 0; i < size; ++i) { max = MAX(max, counts[i]); }
+
+    unsigned char* image = malloc(size * 3 * sizeof(unsigned char));
+    for (int i = 0; i < size; ++i) {
+        float t = (float)counts[i] / (float)max * 3;
+        float r = MIN(1, MAX(0, t - 1));
+        float g = MIN(1, MAX(0, t - 2));
+        float b = t < 1 ? t : MAX(0, 2 - t) + g;
+
+        image[i * 3] = (unsigned char)(r * 255);
+        image[i * 3 + 1] = (unsigned char)(g * 255);
+        image[i * 3 + 2] = (unsigned char)(MIN(1, b) * 255);
+    }
+
+    printf("%s: max %u\n", fileName, max);
+    stbi_write_jpg(fileName, width, height, 3, image, 100);
+    free(image);
 }
 
-int main() {
-    void* p_data;
-    void* p_buffer;
-    size_t file_size;
-    objpar_data_t obj_data;
-
-    p_data = openFile("../res/vector.obj", &file_size);
-    p_buffer = malloc(objpar_get_size(p_data, file_size));
-    objpar((const char*)p_data, file_size, p_buffer, &obj_data);
-    free(p_data);
-
-    // Map indices to new format, from [VertexIndex, TextureIndex, NormalIndex] => [VertexIndex]
-    unsigned int* indices = malloc(obj_data.face_count * 3 * sizeof(unsigned int));
-    for (int i = 0, j = 0; j < obj_data.face_count * 3 * 3; i++, j+=3) {
-        indices[i] = obj_data.p_faces[j];
+/**
+ * Create a colored checkerboard texture
+ *
+ * @param texture Texture to fill, must be released using freeTexture
+ */
+static void createCheckerTexture(Texture* texture) {
+    unsigned int size = 256;
+    unsigned char* pixels = malloc(size * size * 3 * sizeof(unsigned char));
+
+    for (unsigned int y = 0; y < size; ++y) {
+        for (unsigned int x = 0; x < size; ++x) {
+            unsigned char* pixel = pixels + (y * size + x) * 3;
+            int dark = ((x / 16) ^ (y / 16)) & 1;
+            pixel[0] = dark ? 40 : 255;
+            pixel[1] = dark ? 60 : (unsigned char)(128 + x / 2);
+            pixel[2] = dark ? 160 : (unsigned char)(128 + y / 2);
+        }
     }
 
-    printf("Vertices Count: %u\n", obj_data.position_count);
-    printf("Face Count: %u\n", obj_data.face_count);
+    createTexture(pixels, size, size, 3, texture);
+    free(pixels);
+}
+
+/**
+ * Render the demo model
+ *
+ * Usage: rasterizer-demo [--heatmap] [--texture] [--msaa] [--flat|--gouraud] [--depth] [--shadow] [--processes] [--stream]
+ *
+ * The --heatmap option additionally writes the triangle coverage, depth test passes and shader invocations
+ * of every pixel as heatmap images. The --texture option renders the model in color using a checkerboard texture.
+ * The --msaa option smooths the edges using 4x multisampling. The --flat and --gouraud options light every
+ * triangle once or every vertex instead of every pixel. The --depth option only renders the zBuffer image, using
+ * a render target without colors. The --shadow option casts shadows of a light above the camera, a shadow map is
+ * drawn from the light first. The --processes option draws the image using forked worker processes, which share
+ * the render target and heatmaps with the demo. The --stream option additionally draws the colored image in strips
+ * which are written to a PNG file one after another, without allocating a buffer of the size of the image.
+ */
+int main(int argc, char** argv) {
+    int heatmap = 0;
+    int textured = 0;
+    int msaa = 0;
+    int depthOnly = 0;
+    int shadow = 0;
+    int forked = 0;
+    int streamed = 0;
+    PipelineState state = defaultPipelineState();
+    for (int i = 1; i < argc; ++i) {
+        heatmap |= strcmp(argv[i], "--heatmap") == 0;
+        textured |= strcmp(argv[i], "--texture") == 0;
+        msaa |= strcmp(argv[i], "--msaa") == 0;
+        depthOnly |= strcmp(argv[i], "--depth") == 0;
+        shadow |= strcmp(argv[i], "--shadow") == 0;
+        forked |= strcmp(argv[i], "--processes") == 0;
+        streamed |= strcmp(argv[i], "--stream") == 0;
+        if (strcmp(argv[i], "--flat") == 0)
+            state.shadeMode = SHADE_MODE_FLAT;
+        if (strcmp(argv[i], "--gouraud") == 0)
+            state.shadeMode = SHADE_MODE_GOURAUD;
+    }
+
+    Mesh model;
+    if (!loadModel("../res/vector.obj", &model)) {
+        printf("Could not load model\n");
+        return -1;
+    }
+
+    printf("Vertices Count: %u\n", model.vertexCount);
+    printf("Face Count: %u\n", model.indicesCount / 3);
+
+    // Generate level of detail meshes
+    LodChain lodChain;
+    generateLodChain(&model, LOD_MAX_LEVELS, &lodChain);
+
+    for (unsigned int i = 0; i < lodChain.levelCount; ++i) {
+        printf("LOD %u Face Count: %u\n", i, lodChain.levels[i].indicesCount / 3);
+    }
 
     // Raster image dimensions
     int width = 1920;
@@ -62,12 +127,6 @@ int main() {
 
     int size = width * height;
 
-    // Allocate z-buffer on heap
-    float* zBuffer = malloc(size * sizeof(float));
-
-    // Allocate raster image on heap
-    unsigned char* frameBuffer = malloc(size * sizeof(unsigned char));
-
     // Define transformation matrix
     float angle = .5f;
     Matrix4x4 modelViewProjection = {
@@ -79,24 +138,133 @@ int main() {
 
     unsigned char backgroundColor = 0;
 
+    Texture texture;
+    if (textured)
+        createCheckerTexture(&texture);
+
+    // Allocate z-buffer and raster image on heap, the target is tiled and resolved to linear images afterwards
+    ColorFormat colorFormat = depthOnly ? COLOR_FORMAT_NONE : textured ? COLOR_FORMAT_RGB8 : COLOR_FORMAT_GRAY8;
+    RenderTarget target = forked
+        ? createSharedRenderTarget(width, height, colorFormat, DEPTH_FORMAT_FLOAT32, TARGET_LAYOUT_TILED, msaa ? 4 : 1, backgroundColor)
+        : createRenderTarget(width, height, colorFormat, DEPTH_FORMAT_FLOAT32, TARGET_LAYOUT_TILED, msaa ? 4 : 1, backgroundColor);
+
+    // Select level of detail based on the screen size of the mesh
+    const Mesh* mesh = selectLod(&lodChain, &modelViewProjection, &target, &state);
+    Instance instance = { mesh, modelViewProjection, textured ? &texture : NULL };
+    RasterStats stats = { 0 };
+
+    // Worker processes only fill heatmaps in shared memory
+    size_t mapSize = size * sizeof(unsigned int);
+    if (heatmap) {
+        stats.touchMap = forked ? allocateShared(mapSize) : calloc(size, sizeof(unsigned int));
+        stats.depthMap = forked ? allocateShared(mapSize) : calloc(size, sizeof(unsigned int));
+        stats.shadeMap = forked ? allocateShared(mapSize) : calloc(size, sizeof(unsigned int));
+    }
+
+    /*
+     * The shadow map is drawn depth only from a light above and beside the camera, the camera to light matrix undoes
+     * the transformation of the model to the camera and applies the transformation of the model to the light instead
+     */
+    RenderTarget shadowTarget = { 0 };
+    ShadowMap shadowMap = { &shadowTarget };
+    if (shadow) {
+        float yaw = angle + .5f;
+        float tilt = .9f;
+        Matrix4x4 rotation = { { cosf(yaw), 0, sinf(yaw), 0 }, { 0, 1, 0, 0 }, { -sinf(yaw), 0, cosf(yaw), 0 }, { 0, 0, 0, 1 } };
+        Matrix4x4 lightView = { { 1, 0, 0, 0 }, { 0, cosf(tilt), sinf(tilt), 0 }, { 0, -sinf(tilt), cosf(tilt), 0 }, { 0, 0, -4, 1 } };
+        Instance lightInstance = { mesh, mulMatrix4x4(&rotation, &lightView) };
+        DrawList lightList = { &lightInstance, 1, 0, NULL, DRAW_MODE_TILED };
+
+        shadowTarget = createRenderTarget(1024, 1024, COLOR_FORMAT_NONE, DEPTH_FORMAT_FLOAT32, TARGET_LAYOUT_TILED, 1, 0);
+        clearRenderTarget(&shadowTarget);
+        drawInstances(&shadowTarget, &lightList);
+
+        Matrix4x4 cameraToModel = invertAffineMatrix4x4(&modelViewProjection);
+        shadowMap.cameraToLight = mulMatrix4x4(&cameraToModel, &lightInstance.modelViewProjection);
+        shadowMap.deviceAspect = DEVICE_ASPECT;
+        shadowMap.bias = .08f;
+        shadowMap.strength = .6f;
+        shadowMap.filterRadius = 1;
+        state.shadowMap = &shadowMap;
+    }
+
+    // Tiles are drawn in local buffers, the depth is stored as well to write the zBuffer image
+    DrawList drawList = { &instance, 1, 0, &stats, DRAW_MODE_TILED, &state };
+
     // Rasterize triangles
-    rasterize((Vector3*)obj_data.p_positions, indices, obj_data.face_count * 3, &modelViewProjection, zBuffer, frameBuffer, backgroundColor, width, height);
+    clearRenderTarget(&target);
+    if (forked)
+        drawInstancesForked(&target, &drawList, 0);
+    else
+        drawInstances(&target, &drawList);
+
+    // The streamed image only uses the size and formats of the target, the statistics are left to the full draw
+    if (streamed && !depthOnly) {
+        ImageFile file;
+        DrawList stripList = { &instance, 1, 0, NULL, DRAW_MODE_DIRECT, &state };
+        StripStream stream = { writeImageStrip, &file, 0, 0 };
+
+        if (openImageFile(&file, "../streamed.png", IMAGE_FILE_PNG, width, height, colorFormatSize(colorFormat))) {
+            int written = drawInstancesStreamed(&target, &stripList, &stream);
+            if (!closeImageFile(&file) || !written)
+                printf("Could not write streamed image\n");
+        }
+    }
+
+    printf("Triangles: %llu submitted, %llu outside, %llu zero area, %llu back facing, %llu missed, %llu clipped\n",
+        stats.trianglesSubmitted, stats.trianglesOutside, stats.trianglesZeroArea, stats.trianglesBackFacing,
+        stats.trianglesMissed, stats.trianglesClipped);
+    printf("Pixels: %llu tested, %llu inside, %llu depth passes, %llu shaded\n",
+        stats.pixelsTested, stats.pixelsInside, stats.depthPasses, stats.pixelsShaded);
+    printf("Time: transform %.3f ms, setup %.3f ms, raster %.3f ms, shade %.3f ms\n",
+        stats.transformTime * 1e3, stats.setupTime * 1e3, stats.rasterTime * 1e3, stats.shadeTime * 1e3);
+
+    unsigned char* image = depthOnly ? NULL : malloc(size * colorFormatSize(colorFormat));
+    float* zBuffer = malloc(size * sizeof(float));
+    resolveRenderTarget(&target, image, zBuffer);
 
     // Convert zBuffer to image
     unsigned char* zBufferImage = malloc(size * sizeof(unsigned char));
     memset(zBufferImage, 0, size * sizeof(unsigned char));
 
     for (int i = 0; i < size; ++i) {
-        if (zBuffer[i] != FAR_CLIPPING)
+        if (zBuffer[i] != target.farClipping)
             zBufferImage[i] = MAX(zBuffer[i] * 255, 255);
     }
 
-    stbi_write_jpg("../output.jpg", width, height, 1, frameBuffer, width * (int)sizeof(unsigned char));
+    if (image)
+        stbi_write_jpg(textured ? "../textured.jpg" : "../output.jpg", width, height, (int)colorFormatSize(colorFormat), image, width * (int)sizeof(unsigned char));
     stbi_write_jpg("../zBuffer.jpg", width, height, 1, zBufferImage, width * (int)sizeof(float));
 
-    free(frameBuffer);
-    free(zBufferImage);
+    if (heatmap) {
+        writeHeatmap("../touchHeatmap.jpg", stats.touchMap, width, height);
+        writeHeatmap("../depthHeatmap.jpg", stats.depthMap, width, height);
+        writeHeatmap("../shadeHeatmap.jpg", stats.shadeMap, width, height);
+
+        if (forked) {
+            freeShared(stats.touchMap, mapSize);
+            freeShared(stats.depthMap, mapSize);
+            freeShared(stats.shadeMap, mapSize);
+        }
+        else {
+            free(stats.touchMap);
+            free(stats.depthMap);
+            free(stats.shadeMap);
+        }
+    }
+
+    if (textured)
+        freeTexture(&texture);
+
+    free(image);
     free(zBuffer);
-    free(p_buffer);
+    free(zBufferImage);
+    if (forked)
+        freeSharedRenderTarget(&target);
+    else
+        freeRenderTarget(&target);
+    freeRenderTarget(&shadowTarget);
+    freeLodChain(&lodChain);
+    freeModel(&model);
     return 0;
 }
\ No newline at end of file
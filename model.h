@@ -0,0 +1,142 @@
+#ifndef RASTERIZER_MODEL_H
+#define RASTERIZER_MODEL_H
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <objpar.h>
+
+#include "src/include/rasterizer.h"
+
+/**
+ * Read a complete file into memory
+ *
+ * @param p_file_name Path of the file
+ * @param p_file_size Size of the file in bytes
+ * @return Heap allocated file content or NULL when the file could not be opened
+ */
+static void* openFile(const char* p_file_name, size_t* p_file_size)
+{
+    FILE* p_file;
+    void* p_file_data;
+    size_t size;
+    int err;
+
+#if defined(_MSC_VER)
+    fopen_s(&p_file, p_file_name, "rb");
+#else
+    p_file = fopen(p_file_name, "rb+");
+#endif
+    if (p_file == NULL)
+        return NULL;
+    fseek(p_file, 0L, SEEK_END);
+    size = ftell(p_file);
+    rewind(p_file);
+    p_file_data = malloc(size);
+#if defined(_MSC_VER)
+    fread_s(p_file_data, size, size, 1, p_file);
+#else
+    fread(p_file_data, size, 1, p_file);
+#endif
+    err = ferror(p_file);
+    assert(err == 0);
+    fclose(p_file);
+    *p_file_size = size;
+    return p_file_data;
+}
+
+/**
+ * Load the triangles of a Wavefront OBJ file together with their texture coordinates and normals
+ *
+ * OBJ faces index positions, texture coordinates and normals separately. Every unique combination
+ * of the three indices becomes a single vertex, the texture coordinate (u, v) and normal (x, y, z) are
+ * stored as vertex attributes in that order when present in the file.
+ *
+ * @param fileName Path of the OBJ file
+ * @param mesh Mesh to fill, must be released using freeModel
+ * @return Zero when the file could not be loaded, otherwise non zero
+ */
+static int loadModel(const char* fileName, Mesh* mesh) {
+    void* p_data;
+    void* p_buffer;
+    size_t file_size;
+    objpar_data_t obj_data;
+
+    p_data = openFile(fileName, &file_size);
+    if (p_data == NULL)
+        return 0;
+
+    p_buffer = malloc(objpar_get_size(p_data, file_size));
+    objpar((const char*)p_data, file_size, p_buffer, &obj_data);
+    free(p_data);
+
+    unsigned int texcoordCount = obj_data.texcoord_count > 0 ? 2 : 0;
+    unsigned int normalCount = obj_data.normal_count > 0 ? 3 : 0;
+    unsigned int cornerCount = obj_data.face_count * 3;
+
+    memset(mesh, 0, sizeof(Mesh));
+    mesh->attributeCount = texcoordCount + normalCount;
+    mesh->texcoordOffset = texcoordCount ? 0 : -1;
+    mesh->normalOffset = normalCount ? (int)texcoordCount : -1;
+    mesh->indicesCount = cornerCount;
+    mesh->indices = malloc(cornerCount * sizeof(unsigned int));
+    mesh->vertices = malloc(cornerCount * sizeof(Vector3));
+    if (mesh->attributeCount > 0)
+        mesh->attributes = malloc((size_t)cornerCount * mesh->attributeCount * sizeof(float));
+
+    // Open addressing hash table which maps an index combination to the first corner which used it
+    unsigned int tableSize = 1;
+    while (tableSize < cornerCount * 2) { tableSize <<= 1; }
+    unsigned int* table = calloc(tableSize, sizeof(unsigned int));
+    unsigned int* corners = malloc(cornerCount * sizeof(unsigned int));
+
+    for (unsigned int i = 0; i < cornerCount; ++i) {
+        // Face indices are stored as [VertexIndex, TextureIndex, NormalIndex]
+        const unsigned int* face = obj_data.p_faces + i * 3;
+        unsigned int slot = (face[0] * 73856093u ^ face[1] * 19349663u ^ face[2] * 83492791u) & (tableSize - 1);
+
+        while (table[slot] != 0) {
+            const unsigned int* other = obj_data.p_faces + corners[table[slot] - 1] * 3;
+            if (other[0] == face[0] && other[1] == face[1] && other[2] == face[2])
+                break;
+            slot = (slot + 1) & (tableSize - 1);
+        }
+
+        if (table[slot] == 0) {
+            unsigned int vertex = mesh->vertexCount++;
+            const float* position = obj_data.p_positions + (face[0] - 1) * obj_data.position_width;
+            mesh->vertices[vertex] = (Vector3) { position[0], position[1], position[2] };
+
+            float* attributes = mesh->attributes + (size_t)vertex * mesh->attributeCount;
+            for (unsigned int k = 0; k < texcoordCount; ++k) {
+                attributes[k] = face[1] ? obj_data.p_texcoords[(face[1] - 1) * obj_data.texcoord_width + k] : 0;
+            }
+            for (unsigned int k = 0; k < normalCount; ++k) {
+                attributes[texcoordCount + k] = face[2] ? obj_data.p_normals[(face[2] - 1) * obj_data.normal_width + k] : 0;
+            }
+
+            corners[vertex] = i;
+            table[slot] = vertex + 1;
+        }
+        mesh->indices[i] = table[slot];
+    }
+
+    free(table);
+    free(corners);
+    free(p_buffer);
+    return 1;
+}
+
+/**
+ * Release a mesh loaded using loadModel
+ *
+ * @param mesh Mesh to release
+ */
+static void freeModel(Mesh* mesh) {
+    free(mesh->vertices);
+    free(mesh->indices);
+    free(mesh->attributes);
+}
+
+#endif //RASTERIZER_MODEL_H
@@ -0,0 +1,460 @@
+#if !defined(_WIN32)
+    #define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include "model.h"
+#include "src/include/rasterizer.h"
+#include "src/include/lod.h"
+#include "src/include/imagefile.h"
+#include "src/include/threads.h"
+
+#if !defined(_WIN32)
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+
+/**
+ * Count of meshes which can be kept resident
+ */
+#ifndef SERVICE_MAX_MESHES
+    #define SERVICE_MAX_MESHES 64
+#endif
+
+/**
+ * Count of render targets (and resolved images) which are kept allocated, one per recently used resolution
+ */
+#ifndef SERVICE_POOL_SIZE
+    #define SERVICE_POOL_SIZE 4
+#endif
+
+/**
+ * Longest request line in bytes, including the line break
+ */
+#ifndef SERVICE_MAX_LINE
+    #define SERVICE_MAX_LINE 4096
+#endif
+
+/**
+ * Largest width and height of a rendered image in pixels
+ */
+#ifndef SERVICE_MAX_SIZE
+    #define SERVICE_MAX_SIZE 16384
+#endif
+
+/**
+ * Mesh which stays loaded together with its levels of detail
+ */
+typedef struct {
+    Mesh mesh;
+    LodChain lodChain;
+} ResidentMesh;
+
+/**
+ * Render target and resolved image of a single resolution which are reused by every job of that resolution
+ */
+typedef struct {
+    RenderTarget target;
+    unsigned char* image;
+    unsigned long long lastUse;
+} PooledTarget;
+
+/**
+ * State kept between the jobs
+ *
+ * The draw context keeps the worker threads and the frame buffers of the draws, every job draws using it.
+ */
+typedef struct {
+    ResidentMesh meshes[SERVICE_MAX_MESHES];
+    unsigned int meshCount;
+    PooledTarget pool[SERVICE_POOL_SIZE];
+    unsigned long long jobCount;
+    unsigned int threadCount;
+    DrawContext drawContext;
+} Service;
+
+/**
+ * Load a mesh and generate its levels of detail
+ *
+ * @param service Service to add the mesh to
+ * @param path Path of the OBJ file
+ * @param error Message of the failure
+ * @return Index of the mesh, -1 when it could not be loaded
+ */
+static int loadMesh(Service* service, const char* path, const char** error) {
+    if (service->meshCount >= SERVICE_MAX_MESHES) {
+        *error = "too many meshes";
+        return -1;
+    }
+
+    ResidentMesh* resident = &service->meshes[service->meshCount];
+    if (!loadModel(path, &resident->mesh)) {
+        *error = "could not load mesh";
+        return -1;
+    }
+
+    generateLodChain(&resident->mesh, LOD_MAX_LEVELS, &resident->lodChain);
+    return (int)service->meshCount++;
+}
+
+/**
+ * Get the pooled render target of a resolution, the least recently used target is replaced when none matches
+ *
+ * @param service Service owning the pool
+ * @param width Width of the image in pixels
+ * @param height Height of the image in pixels
+ * @return Pooled target, NULL when its buffers could not be allocated
+ */
+static PooledTarget* acquireTarget(Service* service, unsigned int width, unsigned int height) {
+    PooledTarget* pooled = &service->pool[0];
+    for (unsigned int i = 0; i < SERVICE_POOL_SIZE; ++i) {
+        PooledTarget* candidate = &service->pool[i];
+        if (candidate->target.zBuffer && candidate->target.width == width && candidate->target.height == height) {
+            pooled = candidate;
+            break;
+        }
+        if (candidate->lastUse < pooled->lastUse)
+            pooled = candidate;
+    }
+
+    if (!pooled->target.zBuffer || pooled->target.width != width || pooled->target.height != height) {
+        freeRenderTarget(&pooled->target);
+        free(pooled->image);
+
+        pooled->target = createRenderTarget(width, height, COLOR_FORMAT_GRAY8, DEPTH_FORMAT_FLOAT32, TARGET_LAYOUT_TILED, 1, 0);
+        pooled->image = malloc((size_t)width * height);
+        if (!pooled->target.zBuffer || !pooled->target.frameBuffer || !pooled->image) {
+            freeRenderTarget(&pooled->target);
+            free(pooled->image);
+            *pooled = (PooledTarget) { 0 };
+            return NULL;
+        }
+    }
+
+    pooled->lastUse = ++service->jobCount;
+    return pooled;
+}
+
+/**
+ * Get the container of an output file from its extension: .png, .tif or .tiff, otherwise PGM
+ *
+ * @param path Path of the output file
+ * @return Container of the file
+ */
+static ImageFileFormat outputFormat(const char* path) {
+    const char* extension = strrchr(path, '.');
+    if (extension && strcmp(extension, ".png") == 0)
+        return IMAGE_FILE_PNG;
+    if (extension && (strcmp(extension, ".tif") == 0 || strcmp(extension, ".tiff") == 0))
+        return IMAGE_FILE_TIFF;
+    return IMAGE_FILE_PNM;
+}
+
+/**
+ * Render a resident mesh and write the image
+ *
+ * @param service Service owning the meshes and buffers
+ * @param meshIndex Index of the mesh
+ * @param width Width of the image in pixels
+ * @param height Height of the image in pixels
+ * @param modelViewProjection Transformation of the mesh into camera space
+ * @param path Path of the output file
+ * @param error Message of the failure
+ * @return Zero when the job failed, otherwise non zero
+ */
+static int renderMesh(
+        Service* service,
+        unsigned int meshIndex,
+        unsigned int width,
+        unsigned int height,
+        const Matrix4x4* modelViewProjection,
+        const char* path,
+        const char** error) {
+
+    PooledTarget* pooled = acquireTarget(service, width, height);
+    if (!pooled) {
+        *error = "out of memory";
+        return 0;
+    }
+
+    const Mesh* mesh = selectLod(&service->meshes[meshIndex].lodChain, modelViewProjection, &pooled->target, NULL);
+    Instance instance = { mesh, *modelViewProjection };
+    DrawList drawList = { &instance, 1, service->threadCount, NULL, DRAW_MODE_TILED, NULL, &service->drawContext };
+
+    clearRenderTarget(&pooled->target);
+    drawInstances(&pooled->target, &drawList);
+    resolveRenderTarget(&pooled->target, pooled->image, NULL);
+
+    ImageFile file;
+    if (!openImageFile(&file, path, outputFormat(path), width, height, 1)) {
+        *error = "could not create output";
+        return 0;
+    }
+
+    int written = writeImageRows(&file, pooled->image, height);
+    if (!closeImageFile(&file) || !written) {
+        *error = "could not write output";
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Parse and execute a render request: render <mesh> <width> <height> <16 matrix elements> <output path>
+ *
+ * @param service Service owning the meshes and buffers
+ * @param arguments Arguments following the command
+ * @param error Message of the failure
+ * @return Zero when the request failed, otherwise non zero
+ */
+static int renderRequest(Service* service, char* arguments, const char** error) {
+    char* cursor = arguments;
+    char* end;
+
+    unsigned long numbers[3];
+    for (unsigned int i = 0; i < 3; ++i) {
+        numbers[i] = strtoul(cursor, &end, 10);
+        if (end == cursor) {
+            *error = "expected mesh, width and height";
+            return 0;
+        }
+        cursor = end;
+    }
+
+    // The elements are ordered as the rows p1, p2, p3 and p4 of the matrix
+    float elements[16];
+    for (unsigned int i = 0; i < 16; ++i) {
+        elements[i] = strtof(cursor, &end);
+        if (end == cursor) {
+            *error = "expected 16 matrix elements";
+            return 0;
+        }
+        cursor = end;
+    }
+
+    // The output path is the rest of the line and may contain spaces
+    while (*cursor == ' ' || *cursor == '\t') { ++cursor; }
+    if (*cursor == '\0') {
+        *error = "expected output path";
+        return 0;
+    }
+
+    if (numbers[0] >= service->meshCount) {
+        *error = "unknown mesh";
+        return 0;
+    }
+    if (numbers[1] == 0 || numbers[2] == 0 || numbers[1] > SERVICE_MAX_SIZE || numbers[2] > SERVICE_MAX_SIZE) {
+        *error = "invalid resolution";
+        return 0;
+    }
+
+    Matrix4x4 modelViewProjection = {
+        { elements[0], elements[1], elements[2], elements[3] },
+        { elements[4], elements[5], elements[6], elements[7] },
+        { elements[8], elements[9], elements[10], elements[11] },
+        { elements[12], elements[13], elements[14], elements[15] }
+    };
+    return renderMesh(service, (unsigned int)numbers[0], (unsigned int)numbers[1], (unsigned int)numbers[2], &modelViewProjection, cursor, error);
+}
+
+/**
+ * Answer the requests of a client until the end of its input
+ *
+ * Every request is a single line, every reply is a single line which is flushed right away:
+ *
+ *   load <path>                 ok <mesh> <face count>
+ *   render <mesh> <width> <height> <16 matrix elements> <output path>
+ *                               ok <milliseconds>, sent after the output file is written
+ *   quit                        ok, the service exits
+ *
+ * Failed requests are answered by error <message>.
+ *
+ * @param service Service owning the meshes and buffers
+ * @param input Requests of the client
+ * @param output Replies to the client
+ * @return Zero when the client requested to quit, otherwise non zero
+ */
+static int serve(Service* service, FILE* input, FILE* output) {
+    char line[SERVICE_MAX_LINE];
+    while (fgets(line, sizeof(line), input)) {
+        size_t length = strlen(line);
+        const char* error = NULL;
+
+        if (length > 0 && line[length - 1] == '\n') {
+            line[--length] = '\0';
+            if (length > 0 && line[length - 1] == '\r')
+                line[--length] = '\0';
+        }
+        else if (!feof(input)) {
+            // Skip the rest of the line
+            int c;
+            while ((c = fgetc(input)) != EOF && c != '\n') {}
+            fprintf(output, "error line too long\n");
+            fflush(output);
+            continue;
+        }
+
+        char* arguments = line + strcspn(line, " \t");
+        if (*arguments != '\0')
+            *arguments++ = '\0';
+
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        else if (strcmp(line, "load") == 0) {
+            while (*arguments == ' ' || *arguments == '\t') { ++arguments; }
+            int mesh = loadMesh(service, arguments, &error);
+            if (mesh >= 0)
+                fprintf(output, "ok %d %u\n", mesh, service->meshes[mesh].mesh.indicesCount / 3);
+        }
+        else if (strcmp(line, "render") == 0) {
+            double start = timerSeconds();
+            if (renderRequest(service, arguments, &error))
+                fprintf(output, "ok %.3f\n", (timerSeconds() - start) * 1e3);
+        }
+        else if (strcmp(line, "quit") == 0) {
+            fprintf(output, "ok\n");
+            fflush(output);
+            return 0;
+        }
+        else {
+            error = "unknown request";
+        }
+
+        if (error)
+            fprintf(output, "error %s\n", error);
+        fflush(output);
+    }
+    return 1;
+}
+
+/**
+ * Answer the clients of a Unix domain socket one after another, until a client requests to quit
+ *
+ * @param service Service owning the meshes and buffers
+ * @param path Path of the socket, an existing file is replaced
+ * @return Zero when the socket could not be created, otherwise non zero
+ */
+static int serveSocket(Service* service, const char* path) {
+#if defined(_WIN32)
+    (void)service;
+    (void)path;
+    return 0;
+#else
+    struct sockaddr_un address = { 0 };
+    if (strlen(path) >= sizeof(address.sun_path))
+        return 0;
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+        return 0;
+
+    unlink(path);
+    if (bind(listener, (const struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+        close(listener);
+        return 0;
+    }
+
+    printf("ready %s\n", path);
+    fflush(stdout);
+
+    int running = 1;
+    while (running) {
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0)
+            continue;
+
+        // Reading and writing use separate streams of the same connection
+        int duplicate = dup(connection);
+        FILE* input = fdopen(connection, "r");
+        FILE* output = duplicate >= 0 ? fdopen(duplicate, "w") : NULL;
+        if (input && output)
+            running = serve(service, input, output);
+
+        if (input)
+            fclose(input);
+        else
+            close(connection);
+
+        if (output)
+            fclose(output);
+        else if (duplicate >= 0)
+            close(duplicate);
+    }
+
+    close(listener);
+    unlink(path);
+    return 1;
+#endif
+}
+
+/**
+ * Render service which keeps meshes resident between images
+ *
+ * Usage: rasterizer-service [--threads <count>] [--socket <path>] [mesh.obj...]
+ *
+ * The meshes passed as arguments are loaded first, their indices are their positions in the argument list. Requests
+ * are read line by line from stdin and answered on stdout (see serve), or from the clients of a Unix domain socket
+ * when --socket is passed. Images are drawn in gray into render targets which are kept allocated between jobs of
+ * the same resolution, the output is written as PNG, TIFF or PGM depending on the extension of its path. The
+ * worker threads and the frame buffers of the draws are started and allocated once and reused by every job.
+ */
+int main(int argc, char** argv) {
+    Service* service = calloc(1, sizeof(Service));
+    const char* socketPath = NULL;
+
+#if !defined(_WIN32)
+    // A client which disconnects before its reply must not terminate the service
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    int result = 0;
+    for (int i = 1; i < argc && result == 0; ++i) {
+        const char* error = NULL;
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            service->threadCount = (unsigned int)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+            socketPath = argv[++i];
+        else if (loadMesh(service, argv[i], &error) < 0) {
+            fprintf(stderr, "%s: %s\n", argv[i], error);
+            result = -1;
+        }
+    }
+
+    createDrawContext(service->threadCount, &service->drawContext);
+
+    // A missing mesh would shift the indices of all following meshes, the service does not start then
+    if (result != 0) {
+        fprintf(stderr, "Could not load meshes\n");
+    }
+    else if (socketPath) {
+        if (!serveSocket(service, socketPath)) {
+            fprintf(stderr, "Could not listen on %s\n", socketPath);
+            result = -1;
+        }
+    }
+    else {
+        printf("ready\n");
+        fflush(stdout);
+        serve(service, stdin, stdout);
+    }
+
+    freeDrawContext(&service->drawContext);
+    for (unsigned int i = 0; i < SERVICE_POOL_SIZE; ++i) {
+        freeRenderTarget(&service->pool[i].target);
+        free(service->pool[i].image);
+    }
+    for (unsigned int i = 0; i < service->meshCount; ++i) {
+        freeLodChain(&service->meshes[i].lodChain);
+        freeModel(&service->meshes[i].mesh);
+    }
+    free(service);
+    return result;
+}
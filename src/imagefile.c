@@ -0,0 +1,406 @@
+#include "include/imagefile.h"
+#include "include/utils.h"
+
+/**
+ * Largest count of bytes of a stored (uncompressed) deflate block
+ */
+#define PNG_STORED_BLOCK 65535
+
+/**
+ * Largest length of a PNG chunk
+ */
+#define PNG_MAX_CHUNK 0x7FFFFFFFu
+
+/**
+ * Largest size of a classic TIFF file, larger images are written as BigTIFF with 64 bit offsets
+ */
+#define TIFF_MAX_CLASSIC 0xFFFFFFFFull
+
+/**
+ * CRC of every byte value using the reflected polynomial 0xEDB88320 of PNG, the table is constant and can be
+ * shared by all threads writing images
+ */
+static const unsigned int CRC_TABLE[256] = {
+    0x00000000u, 0x77073096u, 0xEE0E612Cu, 0x990951BAu, 0x076DC419u, 0x706AF48Fu, 0xE963A535u, 0x9E6495A3u,
+    0x0EDB8832u, 0x79DCB8A4u, 0xE0D5E91Eu, 0x97D2D988u, 0x09B64C2Bu, 0x7EB17CBDu, 0xE7B82D07u, 0x90BF1D91u,
+    0x1DB71064u, 0x6AB020F2u, 0xF3B97148u, 0x84BE41DEu, 0x1ADAD47Du, 0x6DDDE4EBu, 0xF4D4B551u, 0x83D385C7u,
+    0x136C9856u, 0x646BA8C0u, 0xFD62F97Au, 0x8A65C9ECu, 0x14015C4Fu, 0x63066CD9u, 0xFA0F3D63u, 0x8D080DF5u,
+    0x3B6E20C8u, 0x4C69105Eu, 0xD56041E4u, 0xA2677172u, 0x3C03E4D1u, 0x4B04D447u, 0xD20D85FDu, 0xA50AB56Bu,
+    0x35B5A8FAu, 0x42B2986Cu, 0xDBBBC9D6u, 0xACBCF940u, 0x32D86CE3u, 0x45DF5C75u, 0xDCD60DCFu, 0xABD13D59u,
+    0x26D930ACu, 0x51DE003Au, 0xC8D75180u, 0xBFD06116u, 0x21B4F4B5u, 0x56B3C423u, 0xCFBA9599u, 0xB8BDA50Fu,
+    0x2802B89Eu, 0x5F058808u, 0xC60CD9B2u, 0xB10BE924u, 0x2F6F7C87u, 0x58684C11u, 0xC1611DABu, 0xB6662D3Du,
+    0x76DC4190u, 0x01DB7106u, 0x98D220BCu, 0xEFD5102Au, 0x71B18589u, 0x06B6B51Fu, 0x9FBFE4A5u, 0xE8B8D433u,
+    0x7807C9A2u, 0x0F00F934u, 0x9609A88Eu, 0xE10E9818u, 0x7F6A0DBBu, 0x086D3D2Du, 0x91646C97u, 0xE6635C01u,
+    0x6B6B51F4u, 0x1C6C6162u, 0x856530D8u, 0xF262004Eu, 0x6C0695EDu, 0x1B01A57Bu, 0x8208F4C1u, 0xF50FC457u,
+    0x65B0D9C6u, 0x12B7E950u, 0x8BBEB8EAu, 0xFCB9887Cu, 0x62DD1DDFu, 0x15DA2D49u, 0x8CD37CF3u, 0xFBD44C65u,
+    0x4DB26158u, 0x3AB551CEu, 0xA3BC0074u, 0xD4BB30E2u, 0x4ADFA541u, 0x3DD895D7u, 0xA4D1C46Du, 0xD3D6F4FBu,
+    0x4369E96Au, 0x346ED9FCu, 0xAD678846u, 0xDA60B8D0u, 0x44042D73u, 0x33031DE5u, 0xAA0A4C5Fu, 0xDD0D7CC9u,
+    0x5005713Cu, 0x270241AAu, 0xBE0B1010u, 0xC90C2086u, 0x5768B525u, 0x206F85B3u, 0xB966D409u, 0xCE61E49Fu,
+    0x5EDEF90Eu, 0x29D9C998u, 0xB0D09822u, 0xC7D7A8B4u, 0x59B33D17u, 0x2EB40D81u, 0xB7BD5C3Bu, 0xC0BA6CADu,
+    0xEDB88320u, 0x9ABFB3B6u, 0x03B6E20Cu, 0x74B1D29Au, 0xEAD54739u, 0x9DD277AFu, 0x04DB2615u, 0x73DC1683u,
+    0xE3630B12u, 0x94643B84u, 0x0D6D6A3Eu, 0x7A6A5AA8u, 0xE40ECF0Bu, 0x9309FF9Du, 0x0A00AE27u, 0x7D079EB1u,
+    0xF00F9344u, 0x8708A3D2u, 0x1E01F268u, 0x6906C2FEu, 0xF762575Du, 0x806567CBu, 0x196C3671u, 0x6E6B06E7u,
+    0xFED41B76u, 0x89D32BE0u, 0x10DA7A5Au, 0x67DD4ACCu, 0xF9B9DF6Fu, 0x8EBEEFF9u, 0x17B7BE43u, 0x60B08ED5u,
+    0xD6D6A3E8u, 0xA1D1937Eu, 0x38D8C2C4u, 0x4FDFF252u, 0xD1BB67F1u, 0xA6BC5767u, 0x3FB506DDu, 0x48B2364Bu,
+    0xD80D2BDAu, 0xAF0A1B4Cu, 0x36034AF6u, 0x41047A60u, 0xDF60EFC3u, 0xA867DF55u, 0x316E8EEFu, 0x4669BE79u,
+    0xCB61B38Cu, 0xBC66831Au, 0x256FD2A0u, 0x5268E236u, 0xCC0C7795u, 0xBB0B4703u, 0x220216B9u, 0x5505262Fu,
+    0xC5BA3BBEu, 0xB2BD0B28u, 0x2BB45A92u, 0x5CB36A04u, 0xC2D7FFA7u, 0xB5D0CF31u, 0x2CD99E8Bu, 0x5BDEAE1Du,
+    0x9B64C2B0u, 0xEC63F226u, 0x756AA39Cu, 0x026D930Au, 0x9C0906A9u, 0xEB0E363Fu, 0x72076785u, 0x05005713u,
+    0x95BF4A82u, 0xE2B87A14u, 0x7BB12BAEu, 0x0CB61B38u, 0x92D28E9Bu, 0xE5D5BE0Du, 0x7CDCEFB7u, 0x0BDBDF21u,
+    0x86D3D2D4u, 0xF1D4E242u, 0x68DDB3F8u, 0x1FDA836Eu, 0x81BE16CDu, 0xF6B9265Bu, 0x6FB077E1u, 0x18B74777u,
+    0x88085AE6u, 0xFF0F6A70u, 0x66063BCAu, 0x11010B5Cu, 0x8F659EFFu, 0xF862AE69u, 0x616BFFD3u, 0x166CCF45u,
+    0xA00AE278u, 0xD70DD2EEu, 0x4E048354u, 0x3903B3C2u, 0xA7672661u, 0xD06016F7u, 0x4969474Du, 0x3E6E77DBu,
+    0xAED16A4Au, 0xD9D65ADCu, 0x40DF0B66u, 0x37D83BF0u, 0xA9BCAE53u, 0xDEBB9EC5u, 0x47B2CF7Fu, 0x30B5FFE9u,
+    0xBDBDF21Cu, 0xCABAC28Au, 0x53B39330u, 0x24B4A3A6u, 0xBAD03605u, 0xCDD70693u, 0x54DE5729u, 0x23D967BFu,
+    0xB3667A2Eu, 0xC4614AB8u, 0x5D681B02u, 0x2A6F2B94u, 0xB40BBE37u, 0xC30C8EA1u, 0x5A05DF1Bu, 0x2D02EF8Du
+};
+
+/**
+ * Store a value as little endian bytes
+ *
+ * @param destination Destination of the bytes
+ * @param value Value to store
+ * @param size Count of bytes to store
+ */
+static void putLittleEndian(unsigned char* destination, unsigned long long value, unsigned int size) {
+    for (unsigned int i = 0; i < size; ++i) { destination[i] = (unsigned char)(value >> (i * 8)); }
+}
+
+/**
+ * Store a 32 bit value as big endian bytes
+ *
+ * @param destination Destination of the bytes
+ * @param value Value to store
+ */
+static void putBigEndian(unsigned char* destination, unsigned int value) {
+    for (unsigned int i = 0; i < 4; ++i) { destination[i] = (unsigned char)(value >> ((3 - i) * 8)); }
+}
+
+/**
+ * Update the CRC of a PNG chunk
+ *
+ * @param crc CRC of the preceding bytes
+ * @param data Bytes to add
+ * @param size Count of bytes
+ * @return CRC including the bytes
+ */
+static unsigned int updateCrc(unsigned int crc, const unsigned char* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) { crc = CRC_TABLE[(crc ^ data[i]) & 0xFF] ^ (crc >> 8); }
+    return crc;
+}
+
+/**
+ * Update the Adler-32 checksum of a zlib stream
+ *
+ * @param adler Checksum of the preceding bytes
+ * @param data Bytes to add
+ * @param size Count of bytes
+ * @return Checksum including the bytes
+ */
+static unsigned int updateAdler(unsigned int adler, const unsigned char* data, size_t size) {
+    unsigned int a = adler & 0xFFFF;
+    unsigned int b = adler >> 16;
+
+    // 5552 bytes is the largest count which can not overflow the sums before they are reduced
+    while (size > 0) {
+        size_t count = MIN(size, 5552);
+        for (size_t i = 0; i < count; ++i) {
+            a += data[i];
+            b += a;
+        }
+
+        a %= 65521;
+        b %= 65521;
+        data += count;
+        size -= count;
+    }
+
+    return (b << 16) | a;
+}
+
+/**
+ * Write bytes of a PNG chunk and update the CRC of the chunk
+ *
+ * @param file File to write to
+ * @param data Bytes to write
+ * @param size Count of bytes
+ * @param crc CRC of the chunk to update
+ */
+static void writeChunkBytes(FILE* file, const void* data, size_t size, unsigned int* crc) {
+    fwrite(data, 1, size, file);
+    *crc = updateCrc(*crc, data, size);
+}
+
+/**
+ * Write the length and type of a PNG chunk
+ *
+ * @param file File to write to
+ * @param type Type of the chunk, four characters
+ * @param length Length of the data of the chunk
+ * @return CRC of the chunk after its type
+ */
+static unsigned int beginChunk(FILE* file, const char* type, unsigned int length) {
+    unsigned char header[4];
+    putBigEndian(header, length);
+    fwrite(header, 1, sizeof(header), file);
+
+    unsigned int crc = 0xFFFFFFFF;
+    writeChunkBytes(file, type, 4, &crc);
+    return crc;
+}
+
+/**
+ * Write the CRC which ends a PNG chunk
+ *
+ * @param file File to write to
+ * @param crc CRC of the chunk
+ */
+static void endChunk(FILE* file, unsigned int crc) {
+    unsigned char footer[4];
+    putBigEndian(footer, crc ^ 0xFFFFFFFF);
+    fwrite(footer, 1, sizeof(footer), file);
+}
+
+/**
+ * Store a TIFF directory entry with a single value or a value which fits into the entry
+ *
+ * @param destination Destination of the entry, 12 bytes (classic) or 20 bytes (BigTIFF)
+ * @param big Non zero for BigTIFF
+ * @param tag Tag of the entry
+ * @param type Type of the values
+ * @param count Count of values
+ * @param value Value field of the entry as little endian number: the values or the offset of the values
+ * @return Size of the entry in bytes
+ */
+static unsigned int putTiffEntry(unsigned char* destination, int big, unsigned int tag, unsigned int type, unsigned int count, unsigned long long value) {
+    unsigned int fieldSize = big ? 8 : 4;
+    putLittleEndian(destination, tag, 2);
+    putLittleEndian(destination + 2, type, 2);
+    putLittleEndian(destination + 4, count, fieldSize);
+    putLittleEndian(destination + 4 + fieldSize, value, fieldSize);
+    return 4 + fieldSize * 2;
+}
+
+/**
+ * Write the header of a TIFF file, the pixels follow as a single strip
+ *
+ * @param image Image file
+ */
+static void writeTiffHeader(const ImageFile* image) {
+    enum { TIFF_SHORT = 3, TIFF_LONG = 4, TIFF_LONG8 = 16 };
+
+    unsigned long long dataSize = (unsigned long long)image->width * image->height * image->channels;
+    int big = dataSize + 512 > TIFF_MAX_CLASSIC;
+    unsigned int fieldSize = big ? 8 : 4;
+    unsigned int entryCount = image->channels == 4 ? 11 : 10;
+
+    // The bits per sample of RGB(A) images only fit into the entry of BigTIFF files
+    unsigned int headerSize = big ? 16 : 8;
+    unsigned int directorySize = (big ? 8 : 2) + entryCount * (4 + fieldSize * 2) + fieldSize;
+    int bitsInline = image->channels * 2 <= fieldSize;
+    unsigned long long bitsOffset = headerSize + directorySize;
+    unsigned long long dataOffset = bitsOffset + (bitsInline ? 0 : image->channels * 2);
+
+    unsigned long long bits = 0;
+    for (unsigned int i = 0; i < image->channels; ++i) { bits |= 8ull << (i * 16); }
+
+    unsigned char header[512];
+    unsigned int size = 0;
+    header[size++] = 'I';
+    header[size++] = 'I';
+    if (big) {
+        putLittleEndian(header + size, 43, 2);
+        putLittleEndian(header + size + 2, 8, 2);
+        putLittleEndian(header + size + 4, 0, 2);
+        putLittleEndian(header + size + 6, headerSize, 8);
+        size += 14;
+    }
+    else {
+        putLittleEndian(header + size, 42, 2);
+        putLittleEndian(header + size + 2, headerSize, 4);
+        size += 6;
+    }
+
+    // Entries are sorted by their tag
+    putLittleEndian(header + size, entryCount, big ? 8 : 2);
+    size += big ? 8 : 2;
+    size += putTiffEntry(header + size, big, 256, TIFF_LONG, 1, image->width);
+    size += putTiffEntry(header + size, big, 257, TIFF_LONG, 1, image->height);
+    size += putTiffEntry(header + size, big, 258, TIFF_SHORT, image->channels, bitsInline ? bits : bitsOffset);
+    size += putTiffEntry(header + size, big, 259, TIFF_SHORT, 1, 1);
+    size += putTiffEntry(header + size, big, 262, TIFF_SHORT, 1, image->channels >= 3 ? 2 : 1);
+    size += putTiffEntry(header + size, big, 273, big ? TIFF_LONG8 : TIFF_LONG, 1, dataOffset);
+    size += putTiffEntry(header + size, big, 277, TIFF_SHORT, 1, image->channels);
+    size += putTiffEntry(header + size, big, 278, TIFF_LONG, 1, image->height);
+    size += putTiffEntry(header + size, big, 279, big ? TIFF_LONG8 : TIFF_LONG, 1, dataSize);
+    size += putTiffEntry(header + size, big, 284, TIFF_SHORT, 1, 1);
+    if (image->channels == 4)
+        size += putTiffEntry(header + size, big, 338, TIFF_SHORT, 1, 2);
+
+    putLittleEndian(header + size, 0, fieldSize);
+    size += fieldSize;
+
+    if (!bitsInline) {
+        putLittleEndian(header + size, bits, image->channels * 2);
+        size += image->channels * 2;
+    }
+
+    fwrite(header, 1, size, image->file);
+}
+
+/**
+ * Write the signature and the header chunk of a PNG file
+ *
+ * @param image Image file
+ */
+static void writePngHeader(const ImageFile* image) {
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    fwrite(signature, 1, sizeof(signature), image->file);
+
+    // 8 bits per channel of gray (0), RGB (2) or RGBA (6) pixels, no interlacing
+    unsigned char header[13] = { 0 };
+    putBigEndian(header, image->width);
+    putBigEndian(header + 4, image->height);
+    header[8] = 8;
+    header[9] = image->channels == 1 ? 0 : image->channels == 3 ? 2 : 6;
+
+    unsigned int crc = beginChunk(image->file, "IHDR", sizeof(header));
+    writeChunkBytes(image->file, header, sizeof(header), &crc);
+    endChunk(image->file, crc);
+}
+
+/**
+ * Append rows to a PNG file as data chunks of a zlib stream of stored blocks
+ *
+ * Every row starts with the filter type (none) and is split into stored blocks, the first chunk starts the
+ * zlib stream and the chunk of the last row ends it.
+ *
+ * @param image Image file
+ * @param pixels Linear rows of pixels
+ * @param rowCount Count of rows, not exceeding the remaining rows of the image
+ */
+static void writePngRows(ImageFile* image, const unsigned char* pixels, unsigned int rowCount) {
+    static const unsigned char zlibHeader[2] = { 0x78, 0x01 };
+    size_t pixelsSize = (size_t)image->width * image->channels;
+    size_t rowSize = pixelsSize + 1;
+    size_t blocks = (rowSize + PNG_STORED_BLOCK - 1) / PNG_STORED_BLOCK;
+    size_t encodedSize = rowSize + blocks * 5;
+    unsigned int chunkRows = (unsigned int)MAX(1, (PNG_MAX_CHUNK - 6) / encodedSize);
+
+    while (rowCount > 0) {
+        unsigned int rows = MIN(rowCount, chunkRows);
+        int first = image->rowCount == 0;
+        int last = image->rowCount + rows == image->height;
+        unsigned int crc = beginChunk(image->file, "IDAT", (unsigned int)(rows * encodedSize + (first ? 2 : 0) + (last ? 4 : 0)));
+
+        if (first)
+            writeChunkBytes(image->file, zlibHeader, sizeof(zlibHeader), &crc);
+
+        for (unsigned int y = 0; y < rows; ++y) {
+            const unsigned char* row = pixels + y * pixelsSize;
+
+            // The filter type is the first byte of the first block of the row
+            for (size_t offset = 0; offset < rowSize;) {
+                size_t size = MIN(rowSize - offset, PNG_STORED_BLOCK);
+                int final = last && y + 1 == rows && offset + size == rowSize;
+                unsigned char header[5] = { (unsigned char)final };
+                putLittleEndian(header + 1, size, 2);
+                putLittleEndian(header + 3, ~size & 0xFFFF, 2);
+                writeChunkBytes(image->file, header, sizeof(header), &crc);
+
+                const unsigned char* data = row;
+                size_t dataSize = size - 1;
+                if (offset == 0) {
+                    static const unsigned char filter = 0;
+                    writeChunkBytes(image->file, &filter, 1, &crc);
+                    image->adler = updateAdler(image->adler, &filter, 1);
+                }
+                else {
+                    data = row + offset - 1;
+                    dataSize = size;
+                }
+
+                writeChunkBytes(image->file, data, dataSize, &crc);
+                image->adler = updateAdler(image->adler, data, dataSize);
+                offset += size;
+            }
+        }
+
+        if (last) {
+            unsigned char adler[4];
+            putBigEndian(adler, image->adler);
+            writeChunkBytes(image->file, adler, sizeof(adler), &crc);
+        }
+
+        endChunk(image->file, crc);
+        pixels += rows * pixelsSize;
+        rowCount -= rows;
+        image->rowCount += rows;
+    }
+}
+
+int openImageFile(ImageFile* image, const char* path, ImageFileFormat format, unsigned int width, unsigned int height, unsigned int channels) {
+    *image = (ImageFile) { NULL, format, width, height, channels, 0, 1 };
+    if (width == 0 || height == 0 || (channels != 1 && channels != 3 && channels != 4))
+        return 0;
+
+    image->file = fopen(path, "wb");
+    if (!image->file)
+        return 0;
+
+    switch (format) {
+        case IMAGE_FILE_PNG:
+            writePngHeader(image);
+            break;
+
+        case IMAGE_FILE_TIFF:
+            writeTiffHeader(image);
+            break;
+
+        default:
+            if (channels == 4)
+                fprintf(image->file, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", width, height);
+            else
+                fprintf(image->file, "P%c\n%u %u\n255\n", channels == 1 ? '5' : '6', width, height);
+            break;
+    }
+
+    return !ferror(image->file);
+}
+
+int writeImageRows(ImageFile* image, const unsigned char* pixels, unsigned int rowCount) {
+    rowCount = MIN(rowCount, image->height - image->rowCount);
+
+    // PNM and TIFF files store the rows as they are
+    if (image->format == IMAGE_FILE_PNG) {
+        writePngRows(image, pixels, rowCount);
+    }
+    else {
+        fwrite(pixels, (size_t)image->width * image->channels, rowCount, image->file);
+        image->rowCount += rowCount;
+    }
+
+    return !ferror(image->file);
+}
+
+int writeImageStrip(void* image, const unsigned char* frameBuffer, const float* zBuffer, unsigned int y, unsigned int rowCount) {
+    ImageFile* file = image;
+    (void)zBuffer;
+
+    if (!frameBuffer || y != file->rowCount)
+        return 0;
+    return writeImageRows(file, frameBuffer, rowCount);
+}
+
+int closeImageFile(ImageFile* image) {
+    if (!image->file)
+        return 0;
+
+    if (image->format == IMAGE_FILE_PNG)
+        endChunk(image->file, beginChunk(image->file, "IEND", 0));
+
+    int success = !ferror(image->file) && image->rowCount == image->height;
+    success &= fclose(image->file) == 0;
+    image->file = NULL;
+    return success;
+}
@@ -0,0 +1,81 @@
+#ifndef RASTERIZER_IMAGEFILE_H
+#define RASTERIZER_IMAGEFILE_H
+
+#include <stdio.h>
+
+/**
+ * Container of an image file
+ *
+ * PNM stores gray images as PGM, RGB images as PPM and RGBA images as PAM. PNG is written without compression
+ * (stored deflate blocks), which keeps writing a row as cheap as copying it. TIFF is written uncompressed as a
+ * single strip, images of 4 GB and more are written as BigTIFF.
+ */
+typedef enum {
+    IMAGE_FILE_PNM,
+    IMAGE_FILE_PNG,
+    IMAGE_FILE_TIFF
+} ImageFileFormat;
+
+/**
+ * Image file which is written row by row from top to bottom
+ *
+ * The header is written when the file is opened, as the size of the image is known up front. Rows are appended
+ * as they are written, at no point more than the rows passed to a single write are held in memory.
+ */
+typedef struct {
+    FILE* file;
+    ImageFileFormat format;
+    unsigned int width;
+    unsigned int height;
+    unsigned int channels;
+    unsigned int rowCount;
+    unsigned int adler;
+} ImageFile;
+
+/**
+ * Create an image file and write its header
+ *
+ * @param image Image file to initialize
+ * @param path Path of the file
+ * @param format Container of the file
+ * @param width Width of the image in pixels
+ * @param height Height of the image in pixels
+ * @param channels Count of bytes per pixel: 1 (gray), 3 (RGB) or 4 (RGBA)
+ * @return Zero when the file could not be created, otherwise non zero
+ */
+int openImageFile(ImageFile* image, const char* path, ImageFileFormat format, unsigned int width, unsigned int height, unsigned int channels);
+
+/**
+ * Append rows to an image file
+ *
+ * @param image Image file
+ * @param pixels Linear rows of width pixels of the channels of the image
+ * @param rowCount Count of rows, the rows after the last row of the image are ignored
+ * @return Zero when writing failed, otherwise non zero
+ */
+int writeImageRows(ImageFile* image, const unsigned char* pixels, unsigned int rowCount);
+
+/**
+ * Append the rows of a strip to an image file, a StripWriter of drawInstancesStreamed
+ *
+ * The color format of the streamed image has to match the channels of the image file, depth only images can not
+ * be written.
+ *
+ * @param image Image file (ImageFile)
+ * @param frameBuffer Linear rows of pixels
+ * @param zBuffer Ignored
+ * @param y First row of the strip, the next row of the image
+ * @param rowCount Count of rows of the strip
+ * @return Zero when writing failed, otherwise non zero
+ */
+int writeImageStrip(void* image, const unsigned char* frameBuffer, const float* zBuffer, unsigned int y, unsigned int rowCount);
+
+/**
+ * Finish and close an image file
+ *
+ * @param image Image file
+ * @return Zero when writing failed or not all rows of the image were written, otherwise non zero
+ */
+int closeImageFile(ImageFile* image);
+
+#endif //RASTERIZER_IMAGEFILE_H
@@ -0,0 +1,92 @@
+#ifndef RASTERIZER_LOD_H
+#define RASTERIZER_LOD_H
+
+#include "rasterizer.h"
+
+#ifndef LOD_MAX_LEVELS
+    #define LOD_MAX_LEVELS 8
+#endif
+
+#ifndef LOD_REDUCTION
+    #define LOD_REDUCTION .5f
+#endif
+
+#ifndef LOD_TRIANGLE_PIXELS
+    #define LOD_TRIANGLE_PIXELS 2
+#endif
+
+/**
+ * Chain of progressively simplified meshes
+ *
+ * Level 0 contains the full resolution mesh, each following level contains roughly
+ * LOD_REDUCTION times the triangles of the previous level. The bounding sphere
+ * (in object space) is shared by all levels and is used to select a level at render time.
+ */
+typedef struct {
+    Mesh levels[LOD_MAX_LEVELS];
+    unsigned int levelCount;
+    Vector3 center;
+    float radius;
+} LodChain;
+
+/**
+ * Generate a chain of level of detail meshes using quadric error metric simplification
+ *
+ * Every level is created by collapsing the edges of the previous level with the lowest
+ * quadric error (Garland & Heckbert) until the triangle target of the level is reached.
+ * Collapses which would flip the orientation of a neighbouring triangle are rejected and
+ * open (boundary) edges are weighted to keep the silhouette of the mesh intact.
+ *
+ * @pseudoCode:
+ *   Q ← Call: Sum plane quadrics of all triangles around every vertex
+ *   FOR every level
+ *      Heap ← Call: Compute optimal collapse position and error of every edge
+ *      WHILE triangle count > level target
+ *         e ← Pop: Edge with lowest error
+ *         IF e is outdated or collapse flips a triangle
+ *            THEN continue
+ *         ENDIF
+
+ *         Call: Collapse e, merge quadrics and remove degenerate triangles
+ *         Call: Push updated edges around the collapsed vertex
+ *      ENDWHILE
+ *   ENDFOR
+ *
+ * Vertex attributes are carried over to the simplified levels, a collapsed edge keeps the attributes of
+ * the vertex it collapsed into.
+ *
+ * @param mesh Full resolution mesh
+ * @param levelCount Requested count of levels (including the full resolution level), at most LOD_MAX_LEVELS
+ * @param chain Chain to fill, must be released using freeLodChain
+ * @return Count of levels which could be generated
+ */
+unsigned int generateLodChain(const Mesh* mesh, unsigned int levelCount, LodChain* chain);
+
+/**
+ * Release all meshes owned by a level of detail chain
+ *
+ * @param chain Chain to release
+ */
+void freeLodChain(LodChain* chain);
+
+/**
+ * Select the level of detail for the current frame
+ *
+ * The bounding sphere of the chain is projected using the modelViewProjection to find its
+ * covered area in pixels. The most detailed level which spends at least LOD_TRIANGLE_PIXELS
+ * pixels of that area on each triangle is returned. When the sphere crosses the near
+ * clipping plane the full resolution mesh is returned.
+ *
+ * @param chain Chain to select from
+ * @param modelViewProjection Matrix which stores the transformation for each vertex in the scene
+ * @param target Render target the mesh is drawn into, its size and near clipping distance define the projection
+ * @param state Pipeline state of the draw, NULL for defaultPipelineState
+ * @return Selected mesh
+ */
+const Mesh* selectLod(
+        const LodChain* chain,
+        const Matrix4x4* modelViewProjection,
+        const RenderTarget* target,
+        const PipelineState* state);
+
+#endif //RASTERIZER_LOD_H
@@ -0,0 +1,77 @@
+#ifndef RASTERIZER_PROCESSES_H
+#define RASTERIZER_PROCESSES_H
+
+#include <stddef.h>
+#include "rasterizer.h"
+
+/**
+ * Allocate memory which is shared with the worker processes of drawInstancesForked
+ *
+ * Platforms without fork (Windows) allocate regular memory, drawInstancesForked draws in the calling process there.
+ *
+ * @param size Size in bytes
+ * @return Zero initialized memory, NULL when the allocation failed, must be released using freeShared
+ */
+void* allocateShared(size_t size);
+
+/**
+ * Release memory allocated using allocateShared
+ *
+ * @param memory Memory to release, NULL is ignored
+ * @param size Size in bytes passed to allocateShared
+ */
+void freeShared(void* memory, size_t size);
+
+/**
+ * Allocate the buffers of a render target in shared memory, see createRenderTarget
+ *
+ * The zBuffer is NULL when the allocation failed.
+ *
+ * @param width Width of the image in pixels
+ * @param height Height of the image in pixels
+ * @param colorFormat Pixel layout of the frameBuffer, COLOR_FORMAT_NONE for a depth only target
+ * @param depthFormat Element type of the zBuffer
+ * @param layout Memory layout of the buffers
+ * @param sampleCount Count of samples per pixel: 1, 4 or 8
+ * @param backgroundColor Background color of the framebuffer
+ * @return Render target, must be released using freeSharedRenderTarget
+ */
+RenderTarget createSharedRenderTarget(
+        unsigned int width,
+        unsigned int height,
+        ColorFormat colorFormat,
+        DepthFormat depthFormat,
+        TargetLayout layout,
+        unsigned int sampleCount,
+        unsigned char backgroundColor);
+
+/**
+ * Release the buffers of a render target created using createSharedRenderTarget
+ *
+ * @param target Render target to release
+ */
+void freeSharedRenderTarget(RenderTarget* target);
+
+/**
+ * Draw all instances of a draw list using forked worker processes, see drawInstances
+ *
+ * The image is split into horizontal strips of whole tiles (1 << TILE_SHIFT rows), every worker draws the
+ * tiles of one strip using the scissor rectangle of the pipeline state. The workers are forked after
+ * everything is loaded: they read the meshes, textures and shadow maps of the calling process without
+ * copying them and write their strip straight into the buffers of the target, which therefore have to be
+ * allocated in shared memory (createSharedRenderTarget). The calling process only waits for the workers.
+ *
+ * Every worker draws using the thread count of the draw list, zero spreads the hardware threads over the
+ * workers. The draw context of the draw list is not used: its threads do not survive fork(), so every worker
+ * starts its own threads. The statistics of all workers are added up, which counts the submitted and culled triangles once
+ * per worker. Heatmaps are only filled when they are allocated in shared memory as well. Strips of workers
+ * which could not be forked are drawn by the calling process.
+ *
+ * @param target Render target to draw into, its buffers allocated in shared memory
+ * @param drawList Instances to draw
+ * @param processCount Count of worker processes, zero uses one worker per hardware thread
+ * @return Zero when a worker process failed, otherwise non zero
+ */
+int drawInstancesForked(const RenderTarget* target, const DrawList* drawList, unsigned int processCount);
+
+#endif //RASTERIZER_PROCESSES_H
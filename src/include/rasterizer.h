@@ -5,8 +5,14 @@
 #ifndef RASTERIZER_RASTERIZER_H
 #define RASTERIZER_RASTERIZER_H
 
+#include <stddef.h>
 #include "utils.h"
+#include "texture.h"
+#include "threads.h"
 
+/**
+ * Defaults of the pipeline state (defaultPipelineState) and of the depth range of render targets (createRenderTarget)
+ */
 #ifndef DEVICE_ASPECT
     #define DEVICE_ASPECT 1.f / 1.f
 #endif
@@ -19,6 +25,321 @@
     #define FAR_CLIPPING 100
 #endif
 
+/**
+ * Distance in pixels the guard band extends around the image. Triangles inside of the guard band are rasterized
+ * with their bounding box limited to the image, only triangles leaving it are clipped geometrically.
+ */
+#ifndef GUARD_BAND
+    #define GUARD_BAND 8192
+#endif
+
+#ifndef MAX_ATTRIBUTES
+    #define MAX_ATTRIBUTES 8
+#endif
+
+#ifndef TILE_SHIFT
+    #define TILE_SHIFT 5
+#endif
+
+/**
+ * Default count of rows of the strips of streamed draws, rounded up to a power of two
+ */
+#ifndef STRIP_HEIGHT
+    #define STRIP_HEIGHT 256
+#endif
+
+/**
+ * Indexed triangle mesh
+ *
+ * Indices are stored one-based (as found in Wavefront OBJ files), every three
+ * consecutive indices describe a single triangle.
+ *
+ * Optionally every vertex carries attributeCount floats (at most MAX_ATTRIBUTES are used), which are
+ * interpolated perspective correct over the triangles. The texcoord and normal offsets point to the
+ * first float of the respective attribute within the attributes of a vertex, or are -1 when absent.
+ * Normals are transformed to camera space together with the vertices, all other attributes are
+ * interpolated as is.
+ */
+typedef struct {
+    Vector3* vertices;
+    unsigned int vertexCount;
+    unsigned int* indices;
+    unsigned int indicesCount;
+    float* attributes;
+    unsigned int attributeCount;
+    int texcoordOffset;
+    int normalOffset;
+} Mesh;
+
+/**
+ * Pixel layout of the frameBuffer
+ *
+ * RGB8 and RGBA8 store 3 and 4 bytes per pixel in R, G, B(, A) order, which matches the layout expected
+ * by image writers such as stbi_write_png and stbi_write_jpg. NONE is the format of depth only render targets,
+ * which do not have a frameBuffer.
+ */
+typedef enum {
+    COLOR_FORMAT_GRAY8,
+    COLOR_FORMAT_RGB8,
+    COLOR_FORMAT_RGBA8,
+    COLOR_FORMAT_NONE
+} ColorFormat;
+
+/**
+ * Element type of the zBuffer
+ *
+ * FLOAT32 stores the view depth of every pixel. The unorm formats store the reciprocal depth mapped to
+ * integers, zero at the near and the highest value at the far clipping plane. Like the depth buffer of a GPU
+ * this keeps most precision close to the camera, the depth test compares integers and the division of the
+ * depth is only needed for pixels which pass. UNORM24 is stored in the lower 24 bits of 32 bit elements.
+ */
+typedef enum {
+    DEPTH_FORMAT_FLOAT32,
+    DEPTH_FORMAT_UNORM16,
+    DEPTH_FORMAT_UNORM24
+} DepthFormat;
+
+/**
+ * Memory layout of the zBuffer and frameBuffer of a render target
+ *
+ * Linear targets store rows of pixels after each other. Tiled targets store square tiles of
+ * (1 << TILE_SHIFT) pixels after each other, the tiles and the rows within a tile are stored in row order.
+ * A triangle then touches far fewer cache lines and memory pages than in a linear target, the image is
+ * converted to a linear layout using resolveRenderTarget.
+ */
+typedef enum {
+    TARGET_LAYOUT_LINEAR,
+    TARGET_LAYOUT_TILED
+} TargetLayout;
+
+/**
+ * Buffers to rasterize into
+ *
+ * The buffers store sampleCount elements for each of the renderTargetPixelCount pixels, linear targets without
+ * multisampling store width * height elements. The buffers are either owned by the caller or allocated using
+ * createRenderTarget.
+ *
+ * Render targets without a frameBuffer (NULL) are depth only: draws only write the zBuffer and never run any
+ * shading, regardless of the shade mode of the pipeline state.
+ *
+ * The near and far clipping distances are stored with the buffers as they define the encoding of the zBuffer:
+ * clearing, drawing and resolving a target all use the same depth range. Triangles are clipped at the near
+ * distance (which is also the focal length of the projection) and the zBuffer is cleared to the far distance.
+ *
+ * Multisampled targets (4 or 8 samples, 0 and 1 disable multisampling) test the coverage and depth of every
+ * sample, but shade every pixel only once. The shaded color is stored in all covered samples which pass the
+ * depth test, resolveRenderTarget averages the samples of every pixel.
+ */
+typedef struct {
+    void* zBuffer;
+    unsigned char* frameBuffer;
+    unsigned char backgroundColor;
+    unsigned int width;
+    unsigned int height;
+    ColorFormat colorFormat;
+    DepthFormat depthFormat;
+    TargetLayout layout;
+    unsigned int sampleCount;
+    float nearClipping;
+    float farClipping;
+} RenderTarget;
+
+/**
+ * Single placement of a mesh inside of the scene
+ *
+ * Multiple instances can share the same mesh, the vertex data is never copied.
+ *
+ * When a texture is set and the mesh has texture coordinates, the shade of every pixel is multiplied
+ * with the texture color. The mip level is selected per 2x2 pixel quad from the change of the texture
+ * coordinate between the pixels of the quad. Gray render targets store the luminance of the result.
+ */
+typedef struct {
+    const Mesh* mesh;
+    Matrix4x4 modelViewProjection;
+    const Texture* texture;
+} Instance;
+
+/**
+ * Counters and timings of the stages of the pipeline
+ *
+ * Triangles are culled when they are outside of the view (behind the camera, outside of the image or outside of
+ * the scissor rectangle), do not cover any area or face away from the camera. Small triangles are also culled
+ * when they miss the position of every sample. Triangles crossing the near plane or leaving the guard band are
+ * clipped, the parts of a clipped triangle are not counted by the culling counters. Pixels are tested for every
+ * pixel of the bounding box of the remaining triangles, or only for the span of each row which can be covered
+ * when the triangle is traversed per scanline. The ratio of tested pixels which are inside of a triangle shows
+ * how much of the traversal is wasted.
+ *
+ * Timings are in seconds and summed over all threads. Shading is measured per batch of fragments,
+ * the time spent on the measurement itself is part of the raster time.
+ *
+ * The per pixel maps are optional (NULL to disable) and must be able to store width * height counters.
+ * They count the triangles covering each pixel, the depth test passes of each pixel and the shader
+ * invocations of each pixel, which can be written as heatmaps to find expensive parts of a scene.
+ */
+typedef struct {
+    unsigned long long trianglesSubmitted;
+    unsigned long long trianglesBackFacing;
+    unsigned long long trianglesOutside;
+    unsigned long long trianglesZeroArea;
+    unsigned long long trianglesMissed;
+    unsigned long long trianglesClipped;
+    unsigned long long pixelsTested;
+    unsigned long long pixelsInside;
+    unsigned long long depthPasses;
+    unsigned long long pixelsShaded;
+    double transformTime;
+    double setupTime;
+    double rasterTime;
+    double shadeTime;
+    unsigned int* touchMap;
+    unsigned int* depthMap;
+    unsigned int* shadeMap;
+} RasterStats;
+
+/**
+ * Way the triangles of a draw list are drawn into the render target
+ *
+ * DIRECT draws every triangle straight into the buffers of the render target. The tiled modes bin the
+ * triangles into tiles of (1 << TILE_SHIFT) pixels. Every tile is drawn into small buffers of the thread, which
+ * stay in cache, and written back to the render target once. TILED loads and stores the depth of the render
+ * target, TILED_DISCARD_DEPTH starts every tile at the far clipping plane and never reads or writes the
+ * zBuffer of the render target.
+ */
+typedef enum {
+    DRAW_MODE_DIRECT,
+    DRAW_MODE_TILED,
+    DRAW_MODE_TILED_DISCARD_DEPTH
+} DrawMode;
+
+/**
+ * Shading of the triangles of a draw
+ *
+ * DEPTH_ONLY only writes the depth of the triangles and leaves the frameBuffer untouched. FLAT lights every
+ * triangle once, using its face normal at its center. GOURAUD lights the vertices of every triangle (using the
+ * vertex normals when the mesh has them, otherwise the face normal) and interpolates the shade. PIXEL lights
+ * every pixel using the interpolated normal, TEXTURED additionally multiplies the shade with the texture of the
+ * instance. DEFAULT selects TEXTURED for instances with a texture and PIXEL for all others, TEXTURED falls
+ * back to PIXEL for instances without a texture as well.
+ */
+typedef enum {
+    SHADE_MODE_DEFAULT,
+    SHADE_MODE_DEPTH_ONLY,
+    SHADE_MODE_FLAT,
+    SHADE_MODE_GOURAUD,
+    SHADE_MODE_PIXEL,
+    SHADE_MODE_TEXTURED,
+    SHADE_MODE_COUNT
+} ShadeMode;
+
+/**
+ * Depth of the scene seen from a light, used to darken the pixels which the light does not reach
+ *
+ * The target is drawn first from the point of view of the light, usually as depth only target. The camera to
+ * light matrix transforms the camera space of the draw which receives the shadows to the camera space of the
+ * light, and the device aspect is the one the shadow map was drawn with. A pixel is in shadow when it is further
+ * from the light than the stored depth plus the bias (in units of view depth), which keeps surfaces from shadowing
+ * themselves. The filter radius enables percentage closer filtering: the (2 * radius + 1)^2 nearest depths of
+ * the shadow map are compared, which softens the edges of the shadows. The strength is the share of the shade
+ * which is removed in full shadow, from 0 to 1. Pixels outside of the shadow map are lit.
+ */
+typedef struct {
+    const RenderTarget* target;
+    Matrix4x4 cameraToLight;
+    float deviceAspect;
+    float bias;
+    float strength;
+    unsigned int filterRadius;
+} ShadowMap;
+
+/**
+ * Rectangle of pixels, x and y are the column and row of its top left pixel
+ */
+typedef struct {
+    unsigned int x;
+    unsigned int y;
+    unsigned int width;
+    unsigned int height;
+} Rect;
+
+/**
+ * Configuration of the pipeline which applies to a complete draw list
+ *
+ * The device aspect is the aspect ratio (width / height) of the view, images of a different aspect ratio show
+ * the complete view and extend it along their longer side. Every combination of shade mode, multisampling and
+ * depth format is drawn by its own raster kernel, which is selected once per draw. When a shadow map is set
+ * (NULL to disable) the shaded triangles receive its shadows.
+ *
+ * The scissor rectangle (NULL for the complete target) limits the pixels which are drawn, the projection is not
+ * changed by it. Triangles outside of the rectangle are culled during setup and the raster bands and tiles only
+ * cover the rectangle, all pixels outside of it are left untouched.
+ */
+typedef struct {
+    float deviceAspect;
+    ShadeMode shadeMode;
+    const ShadowMap* shadowMap;
+    const Rect* scissor;
+} PipelineState;
+
+/**
+ * Threads and frame buffers which are kept between the draws of a caller drawing many images
+ *
+ * Draws without a context start the threads of every stage and allocate the buffers of the frame (transformed
+ * vertices, set up triangles, bins, tile buffers) per draw. Draws using a context run their stages on its
+ * thread pool and take the buffers from its storage, which only grows. Repeated draws of a similar size do not
+ * start threads or allocate memory. A context is used by a single draw at a time and cannot cross fork(): its
+ * threads only exist in the process which created it.
+ */
+typedef struct {
+    ThreadPool pool;
+    void* storage;
+} DrawContext;
+
+/**
+ * List of instances which are drawn together in one submission
+ *
+ * The thread count defines the count of threads to draw with, zero uses all hardware threads. When context is
+ * not NULL the threads of its pool are used instead, drawInstancesForked ignores it. When stats is not NULL the statistics of the submission are
+ * added to it, the caller is responsible for clearing it at the start of a frame. When state is NULL the
+ * instances are drawn using defaultPipelineState.
+ */
+typedef struct {
+    const Instance* instances;
+    unsigned int instanceCount;
+    unsigned int threadCount;
+    RasterStats* stats;
+    DrawMode mode;
+    const PipelineState* state;
+    DrawContext* context;
+} DrawList;
+
+/**
+ * Receiver of the rows of an image drawn using drawInstancesStreamed
+ *
+ * The rows are passed from top to bottom, the buffers are only valid during the call.
+ *
+ * @param context User defined context of the stream
+ * @param frameBuffer Linear rows of pixels of the color format of the image, NULL for depth only images
+ * @param zBuffer Linear rows of view depth values, NULL when the stream does not resolve the depth
+ * @param y First row
+ * @param rowCount Count of rows
+ * @return Zero to cancel the draw, otherwise non zero
+ */
+typedef int (*StripWriter)(void* context, const unsigned char* frameBuffer, const float* zBuffer, unsigned int y, unsigned int rowCount);
+
+/**
+ * Destination of an image which is drawn in horizontal strips
+ *
+ * The strip height is rounded up to a power of two, zero uses STRIP_HEIGHT. The depth of the strips is only
+ * resolved for the writer when resolveDepth is non zero.
+ */
+typedef struct {
+    StripWriter writer;
+    void* context;
+    unsigned int stripHeight;
+    int resolveDepth;
+} StripStream;
+
 /**
  * Rasterize a list of triangles to a grayscale image
  *
@@ -55,7 +376,7 @@
  * @param indicesCount Count of indices which is contained in the indices array
  * @param modelViewProjection Matrix which stores the transformation for each vertex in the scene
  * @param zBuffer Pointer to buffer which stores depth information of triangles
- * @param frameBuffer Pointer to buffer which stores the raster image
+ * @param frameBuffer Pointer to buffer which stores the raster image, NULL to only render the zBuffer
  * @param backgroundColor Background color of the framebuffer
  * @param width Width of the image in pixels
  * @param height Height of the image in pixels
@@ -71,4 +392,218 @@ void rasterize(
         unsigned int width,
         unsigned int height);
 
+/**
+ * Get the pipeline state used by draw lists without a state
+ *
+ * @return State with the device aspect of DEVICE_ASPECT, the default shade mode, no shadow map and no scissor rectangle
+ */
+PipelineState defaultPipelineState(void);
+
+/**
+ * Add the counters and timings of statistics to a total, the heatmaps are not touched
+ *
+ * @param total Statistics to add to
+ * @param stats Statistics to add
+ */
+void addRasterStats(RasterStats* total, const RasterStats* stats);
+
+/**
+ * Get the size of a single pixel of a color format
+ *
+ * @param colorFormat Color format
+ * @return Size in bytes
+ */
+unsigned int colorFormatSize(ColorFormat colorFormat);
+
+/**
+ * Get the size of a single element of a depth format
+ *
+ * @param depthFormat Depth format
+ * @return Size in bytes
+ */
+unsigned int depthFormatSize(DepthFormat depthFormat);
+
+/**
+ * Get the count of elements stored in the buffers of a render target
+ *
+ * Tiled targets are padded to a multiple of the tile size in both dimensions.
+ *
+ * @param target Render target
+ * @return Count of pixels
+ */
+size_t renderTargetPixelCount(const RenderTarget* target);
+
+/**
+ * Compute the scale of the camera x and y coordinates which fits the view of a device into an image
+ *
+ * @param deviceAspect Aspect ratio (width / height) of the view
+ * @param width Width of the image in pixels
+ * @param height Height of the image in pixels
+ * @param wAspect Destination of the scale of x
+ * @param hAspect Destination of the scale of y
+ */
+void viewAspect(float deviceAspect, unsigned int width, unsigned int height, float* wAspect, float* hAspect);
+
+/**
+ * This functions translates a camera coordinate to raster space.
+ *
+ * Camera coordinates are defined in the range of -1 to 1.
+ * We need to map the coordinate to there respective raster coordinate which is
+ * defined by the width and height of the screen pixels.
+ *
+ * @param v Camera vector
+ * @param width Width in pixels of the screen
+ * @param height Height in pixels of the screen
+ * @param wAspect Corrected scale x, see viewAspect
+ * @param hAspect Corrected scale y, see viewAspect
+ * @param near Near clipping distance, the focal length of the projection
+ * @return Returns a vector3 defined in raster space coordinate. The actual coordinate is a Vector2 but the inverted z component is added
+ *         to later be used in rasterisation depth.
+ */
+Vector3 cameraToRaster(const Vector3* v, float width, float height, float wAspect, float hAspect, float near);
+
+/**
+ * Allocate the buffers of a render target
+ *
+ * The depth range of the target is set to NEAR_CLIPPING and FAR_CLIPPING, it can be changed before the
+ * target is cleared.
+ *
+ * @param width Width of the image in pixels
+ * @param height Height of the image in pixels
+ * @param colorFormat Pixel layout of the frameBuffer, COLOR_FORMAT_NONE for a depth only target
+ * @param depthFormat Element type of the zBuffer
+ * @param layout Memory layout of the buffers
+ * @param sampleCount Count of samples per pixel: 1, 4 or 8
+ * @param backgroundColor Background color of the framebuffer
+ * @return Render target, must be released using freeRenderTarget
+ */
+RenderTarget createRenderTarget(
+        unsigned int width,
+        unsigned int height,
+        ColorFormat colorFormat,
+        DepthFormat depthFormat,
+        TargetLayout layout,
+        unsigned int sampleCount,
+        unsigned char backgroundColor);
+
+/**
+ * Release the buffers of a render target created using createRenderTarget
+ *
+ * @param target Render target to release
+ */
+void freeRenderTarget(RenderTarget* target);
+
+/**
+ * Clear the frame buffer (when present) to the background color and the z-buffer to the far clipping plane
+ *
+ * @param target Render target to clear
+ */
+void clearRenderTarget(const RenderTarget* target);
+
+/**
+ * Clear the pixels of a render target inside of a rectangle, like clearRenderTarget
+ *
+ * Together with the scissor rectangle of the pipeline state this redraws a part of the image, the pixels
+ * outside of the rectangle keep their content.
+ *
+ * @param target Render target to clear
+ * @param rect Pixels to clear, limited to the target, NULL to clear the complete target
+ */
+void clearRenderTargetRect(const RenderTarget* target, const Rect* rect);
+
+/**
+ * Copy the buffers of a render target to linear images
+ *
+ * The samples of multisampled targets are resolved: the color is the average of all samples, the depth
+ * the closest depth of all samples.
+ *
+ * @param target Render target to copy
+ * @param frameBuffer Destination of width * height pixels of the color format, NULL to skip (ignored for depth only targets)
+ * @param zBuffer Destination of width * height view depth values (converted from the depth format), NULL to skip
+ */
+void resolveRenderTarget(const RenderTarget* target, unsigned char* frameBuffer, float* zBuffer);
+
+/**
+ * Start the threads of a draw context, its storage is allocated by the first draw
+ *
+ * @param threadCount Count of threads to draw with, zero uses all hardware threads
+ * @param context Context to create, must be released using freeDrawContext
+ */
+void createDrawContext(unsigned int threadCount, DrawContext* context);
+
+/**
+ * Stop the threads of a draw context and release its storage
+ *
+ * @param context Context to release
+ */
+void freeDrawContext(DrawContext* context);
+
+/**
+ * Draw all instances of a draw list on top of the current content of the render target
+ *
+ * The vertices of every instance are transformed once, spread over the threads of the draw list.
+ * Afterwards the image is split in horizontal bands (or tiles, depending on the draw mode) which are
+ * rasterized in parallel, every band walks the triangles of all instances in submission order. Each pixel
+ * is therefore only ever written by a single thread and the result is identical to drawing the instances
+ * one by one.
+ *
+ * @param target Render target to draw into
+ * @param drawList Instances to draw
+ */
+void drawInstances(const RenderTarget* target, const DrawList* drawList);
+
+/**
+ * Draw all instances of a draw list into an image which is streamed to a writer in horizontal strips
+ *
+ * The image is described by a render target without buffers: its size, formats, sample count, depth range and
+ * background color are used, its buffers and layout are ignored. COLOR_FORMAT_NONE draws the image depth only.
+ * The triangles are set up once and binned per strip. Afterwards every strip is cleared, drawn into buffers of
+ * the size of a strip (split into bands over the threads like DRAW_MODE_DIRECT, the draw mode of the draw list is
+ * ignored), resolved and passed to the writer. The memory used therefore depends on the strip size and the scene,
+ * not on the size of the image. The result is identical to drawing the image into a cleared render target.
+ *
+ * @param image Size and formats of the image
+ * @param drawList Instances to draw
+ * @param stream Writer of the strips
+ * @return Zero when the writer cancelled the draw, otherwise non zero
+ */
+int drawInstancesStreamed(const RenderTarget* image, const DrawList* drawList, const StripStream* stream);
+
+/**
+ * Count the samples of the triangles of a draw list which pass the depth test against the zBuffer of a target
+ *
+ * The instances (typically simplified proxies of expensive meshes) are set up and rasterized depth only, like a
+ * direct draw, but neither the zBuffer nor the frameBuffer is written. The samples of every triangle are tested
+ * on their own, samples covered by several proxy triangles are counted more than once. Back facing triangles are
+ * culled and triangles are clipped at the near clipping plane, a proxy containing the camera can therefore report
+ * zero samples. The draw mode of the draw list is ignored.
+ *
+ * @param target Render target with the zBuffer to test against
+ * @param drawList Proxy instances, the scissor rectangle of the state limits the tested pixels
+ * @return Count of samples which passed the depth test, zero when the proxies are hidden
+ */
+unsigned long long queryOcclusion(const RenderTarget* target, const DrawList* drawList);
+
+/**
+ * Count the samples of the front faces of a bounding box which pass the depth test, see queryOcclusion
+ *
+ * A box crossing the near clipping plane is reported as visible using the count of samples of the complete target
+ * (or of the scissor rectangle), as its clipped faces could miss visible samples.
+ *
+ * @param target Render target with the zBuffer to test against
+ * @param boxMin Smallest coordinates of the box in object space
+ * @param boxMax Largest coordinates of the box in object space
+ * @param modelViewProjection Transformation of the box into camera space
+ * @param state Pipeline state, NULL for defaultPipelineState
+ * @param threadCount Count of threads to test with, zero uses all hardware threads
+ * @return Count of samples which passed the depth test, zero when the box is hidden
+ */
+unsigned long long queryBoxOcclusion(
+        const RenderTarget* target,
+        const Vector3* boxMin,
+        const Vector3* boxMax,
+        const Matrix4x4* modelViewProjection,
+        const PipelineState* state,
+        unsigned int threadCount);
+
 #endif //RASTERIZER_RASTERIZER_H
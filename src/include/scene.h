@@ -0,0 +1,82 @@
+#ifndef RASTERIZER_SCENE_H
+#define RASTERIZER_SCENE_H
+
+#include "rasterizer.h"
+
+/**
+ * Draw state of a single instance of a retained scene
+ *
+ * The bounding box of the mesh (in object space) is computed once per mesh, the raster bounds are the pixels the
+ * instance could have covered at its last draw.
+ */
+typedef struct {
+    const Mesh* boxMesh;
+    Vector3 boxMin;
+    Vector3 boxMax;
+    Rect bounds;
+    int visible;
+    int dirty;
+} RetainedInstance;
+
+/**
+ * Scene whose image is kept in a render target between frames
+ *
+ * The instances of the draw list are owned by the caller, which changes them in place (matrix, mesh or texture)
+ * and marks them dirty. The next draw only clears and redraws the tiles (1 << TILE_SHIFT pixels wide and high)
+ * covered by the previous and the new raster bounds of the dirty instances, all other tiles keep their colors and
+ * depths. Every instance overlapping the redrawn tiles is drawn again, the image is therefore identical to drawing
+ * the complete scene into a cleared target.
+ *
+ * The raster bounds are computed from the bounding box of the mesh, instances crossing the near clipping plane
+ * cover the complete target. Changes which do not belong to a single instance (the pipeline state, a shadow map,
+ * the background color or the instance count) require invalidateRetainedScene.
+ */
+typedef struct {
+    const RenderTarget* target;
+    DrawList drawList;
+    RetainedInstance* retained;
+    int valid;
+} RetainedScene;
+
+/**
+ * Create a retained scene, the first draw draws the complete scene
+ *
+ * @param target Render target which keeps the image, not written by anything else between draws
+ * @param drawList Instances, thread count, statistics, draw mode and pipeline state of every draw, the scissor
+ *        rectangle of the pipeline state limits every draw
+ * @param scene Scene to fill, must be released using freeRetainedScene
+ */
+void createRetainedScene(const RenderTarget* target, const DrawList* drawList, RetainedScene* scene);
+
+/**
+ * Release the draw state of a retained scene, the instances and the target are left untouched
+ *
+ * @param scene Scene to release
+ */
+void freeRetainedScene(RetainedScene* scene);
+
+/**
+ * Mark an instance whose matrix, mesh or texture was changed since the last draw
+ *
+ * @param scene Scene of the instance
+ * @param instance Index of the instance in the draw list
+ */
+void markInstanceDirty(RetainedScene* scene, unsigned int instance);
+
+/**
+ * Discard the kept image, the next draw draws the complete scene
+ *
+ * @param scene Scene to invalidate
+ */
+void invalidateRetainedScene(RetainedScene* scene);
+
+/**
+ * Redraw the parts of the image changed by the dirty instances
+ *
+ * @param scene Scene to draw
+ * @param redrawn Destination of the rectangle which was cleared and redrawn, NULL to ignore
+ * @return Zero when nothing had to be redrawn, otherwise non zero
+ */
+int drawRetainedScene(RetainedScene* scene, Rect* redrawn);
+
+#endif //RASTERIZER_SCENE_H
@@ -0,0 +1,81 @@
+#ifndef RASTERIZER_TEXTURE_H
+#define RASTERIZER_TEXTURE_H
+
+#include "utils.h"
+
+#ifndef TEXTURE_MAX_LEVELS
+    #define TEXTURE_MAX_LEVELS 16
+#endif
+
+/**
+ * Single mip level of a texture
+ *
+ * Texels are packed RGBA pixels (R, G, B, A in memory order) stored in Morton (Z) order. The level is
+ * split in square blocks of squareSize * squareSize texels along its longer side, the texels within a
+ * block are ordered by interleaving the bits of their x and y coordinate. The 2x2 footprint of a bilinear
+ * sample and the texels of neighbouring pixels therefore mostly share a cache line.
+ */
+typedef struct {
+    unsigned int* texels;
+    unsigned int width;
+    unsigned int height;
+    unsigned int squareShift;
+} TextureLevel;
+
+/**
+ * Texture with a complete chain of mip levels
+ *
+ * Level 0 has power of two dimensions, every following level halves the dimensions of the previous level
+ * until both are a single texel.
+ */
+typedef struct {
+    TextureLevel levels[TEXTURE_MAX_LEVELS];
+    unsigned int levelCount;
+} Texture;
+
+/**
+ * Create a texture and its mip chain from a linear image
+ *
+ * Images without power of two dimensions are resampled (nearest neighbour) to the next power of two.
+ * Every mip level is created by averaging 2x2 texels of the previous level.
+ *
+ * @param pixels Linear image, rows of width pixels stored top to bottom
+ * @param width Width of the image in pixels
+ * @param height Height of the image in pixels
+ * @param channels Count of bytes per pixel: 1 (gray), 3 (RGB) or 4 (RGBA)
+ * @param texture Texture to fill, must be released using freeTexture
+ * @return Zero when the texture could not be created, otherwise non zero
+ */
+int createTexture(const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int channels, Texture* texture);
+
+/**
+ * Release all levels of a texture
+ *
+ * @param texture Texture to release
+ */
+void freeTexture(Texture* texture);
+
+/**
+ * Compute the mip level of a pixel from the screen space derivatives of its texture coordinate
+ *
+ * @param texture Texture to sample
+ * @param dudx Change of u between horizontally neighbouring pixels
+ * @param dvdx Change of v between horizontally neighbouring pixels
+ * @param dudy Change of u between vertically neighbouring pixels
+ * @param dvdy Change of v between vertically neighbouring pixels
+ * @return Level of detail, zero or negative when the texture is magnified
+ */
+float textureLod(const Texture* texture, float dudx, float dvdx, float dudy, float dvdy);
+
+/**
+ * Bilinear sample of the mip level nearest to the level of detail, the texture repeats outside of 0 to 1
+ *
+ * @param texture Texture to sample
+ * @param u Horizontal texture coordinate
+ * @param v Vertical texture coordinate, zero is the bottom of the image
+ * @param lod Level of detail computed using textureLod
+ * @return Packed RGBA pixel
+ */
+unsigned int sampleTexture(const Texture* texture, float u, float v, float lod);
+
+#endif //RASTERIZER_TEXTURE_H
@@ -0,0 +1,80 @@
+#ifndef RASTERIZER_THREADS_H
+#define RASTERIZER_THREADS_H
+
+/**
+ * Job executed by parallelFor
+ *
+ * @param context User defined context which is shared by all jobs
+ * @param job Index of the job
+ * @param thread Index of the thread executing the job, lower than the thread count
+ */
+typedef void (*ParallelJob)(void* context, unsigned int job, unsigned int thread);
+
+/**
+ * Threads which are started once and execute the jobs of many parallelForPool calls
+ *
+ * The pool owns threadCount - 1 worker threads which wait for work between calls, the calling thread takes part
+ * as thread 0. A pool executes the jobs of a single call at a time.
+ */
+typedef struct {
+    unsigned int threadCount;
+    void* shared;
+} ThreadPool;
+
+/**
+ * Get the number of hardware threads available to the process
+ *
+ * @return Count of hardware threads, at least one
+ */
+unsigned int hardwareThreadCount(void);
+
+/**
+ * Read a monotonic clock
+ *
+ * @return Time in seconds since an undefined starting point
+ */
+double timerSeconds(void);
+
+/**
+ * Execute a list of jobs spread over multiple threads
+ *
+ * Jobs are interleaved over the threads, thread t executes jobs t, t + threadCount, t + 2 * threadCount...
+ * This keeps neighbouring jobs (for example neighbouring rows of an image) on different threads without
+ * the need of any synchronization. The calling thread executes the jobs of thread 0 and the function
+ * returns after all jobs are finished.
+ *
+ * @param jobCount Count of jobs to execute
+ * @param threadCount Count of threads to use, zero uses all hardware threads
+ * @param job Job to execute
+ * @param context User defined context passed to every job
+ */
+void parallelFor(unsigned int jobCount, unsigned int threadCount, ParallelJob job, void* context);
+
+/**
+ * Start the worker threads of a pool
+ *
+ * @param threadCount Count of threads including the calling thread, zero uses all hardware threads
+ * @param pool Pool to start, must be released using freeThreadPool
+ */
+void createThreadPool(unsigned int threadCount, ThreadPool* pool);
+
+/**
+ * Stop and join the worker threads of a pool
+ *
+ * @param pool Pool to release
+ */
+void freeThreadPool(ThreadPool* pool);
+
+/**
+ * Execute a list of jobs using the threads of a pool
+ *
+ * Jobs are spread over the threads like parallelFor spreads them, without starting any thread.
+ *
+ * @param pool Pool to execute the jobs with
+ * @param jobCount Count of jobs to execute
+ * @param job Job to execute
+ * @param context User defined context passed to every job
+ */
+void parallelForPool(ThreadPool* pool, unsigned int jobCount, ParallelJob job, void* context);
+
+#endif //RASTERIZER_THREADS_H
@@ -5,6 +5,35 @@
 #ifndef RASTERIZER_UTILS_H
 #define RASTERIZER_UTILS_H
 
+#include <math.h>
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+/**
+ * Normalize vectors using the approximate reciprocal square root of the CPU and compute the perspective divide
+ * using its approximate reciprocal (both refined by a single Newton step, about 22 bits of precision) instead
+ * of square roots and divisions
+ */
+#ifndef FAST_MATH
+    #define FAST_MATH 0
+#endif
+
+/**
+ * Inline a function even when the compiler considers it too large, used for functions which are specialized
+ * by inlining them with constant arguments
+ */
+#if defined(_MSC_VER)
+    #define FORCE_INLINE __forceinline
+#else
+    #define FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
 /**
  * Vector with x, y and z components
  */
@@ -27,6 +56,125 @@ typedef struct { Vector4 p1, p2, p3, p4; } Matrix4x4;
 #define MAX3(x, y, z) MAX(x, MAX(y, z))
 #define MIN3(x, y, z) MIN(x, MIN(y, z))
 
+/**
+ * Register of SIMD_WIDTH floats of the widest available instruction set (AVX, SSE or NEON), a single float
+ * when none is available. The batched functions are written once using the FloatN operations.
+ */
+#if defined(__AVX__)
+    #define SIMD_WIDTH 8
+    typedef __m256 FloatN;
+
+    static inline FloatN floatNSet(float v) { return _mm256_set1_ps(v); }
+    static inline FloatN floatNRamp(float start) { return _mm256_add_ps(_mm256_set1_ps(start), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)); }
+    static inline FloatN floatNAdd(FloatN a, FloatN b) { return _mm256_add_ps(a, b); }
+    static inline FloatN floatNSub(FloatN a, FloatN b) { return _mm256_sub_ps(a, b); }
+    static inline FloatN floatNMul(FloatN a, FloatN b) { return _mm256_mul_ps(a, b); }
+    static inline FloatN floatNDiv(FloatN a, FloatN b) { return _mm256_div_ps(a, b); }
+    static inline FloatN floatNRcp(FloatN v) {
+        FloatN r = _mm256_rcp_ps(v);
+        return _mm256_mul_ps(r, _mm256_sub_ps(_mm256_set1_ps(2), _mm256_mul_ps(v, r)));
+    }
+    static inline FloatN floatNLoad(const float* p) { return _mm256_loadu_ps(p); }
+    static inline void floatNStore(float* p, FloatN v) { _mm256_storeu_ps(p, v); }
+#elif defined(__SSE2__) || defined(_M_X64)
+    #define SIMD_WIDTH 4
+    typedef __m128 FloatN;
+
+    static inline FloatN floatNSet(float v) { return _mm_set1_ps(v); }
+    static inline FloatN floatNRamp(float start) { return _mm_add_ps(_mm_set1_ps(start), _mm_setr_ps(0, 1, 2, 3)); }
+    static inline FloatN floatNAdd(FloatN a, FloatN b) { return _mm_add_ps(a, b); }
+    static inline FloatN floatNSub(FloatN a, FloatN b) { return _mm_sub_ps(a, b); }
+    static inline FloatN floatNMul(FloatN a, FloatN b) { return _mm_mul_ps(a, b); }
+    static inline FloatN floatNDiv(FloatN a, FloatN b) { return _mm_div_ps(a, b); }
+    static inline FloatN floatNRcp(FloatN v) {
+        FloatN r = _mm_rcp_ps(v);
+        return _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(2), _mm_mul_ps(v, r)));
+    }
+    static inline FloatN floatNLoad(const float* p) { return _mm_loadu_ps(p); }
+    static inline void floatNStore(float* p, FloatN v) { _mm_storeu_ps(p, v); }
+#elif defined(__ARM_NEON)
+    #define SIMD_WIDTH 4
+    typedef float32x4_t FloatN;
+
+    static inline FloatN floatNSet(float v) { return vdupq_n_f32(v); }
+    static inline FloatN floatNRamp(float start) {
+        static const float ramp[4] = { 0, 1, 2, 3 };
+        return vaddq_f32(vdupq_n_f32(start), vld1q_f32(ramp));
+    }
+    static inline FloatN floatNAdd(FloatN a, FloatN b) { return vaddq_f32(a, b); }
+    static inline FloatN floatNSub(FloatN a, FloatN b) { return vsubq_f32(a, b); }
+    static inline FloatN floatNMul(FloatN a, FloatN b) { return vmulq_f32(a, b); }
+    static inline FloatN floatNDiv(FloatN a, FloatN b) {
+    #if defined(__aarch64__)
+        return vdivq_f32(a, b);
+    #else
+        // 32 bit NEON has no division
+        float x[4], y[4];
+        vst1q_f32(x, a);
+        vst1q_f32(y, b);
+        for (int i = 0; i < 4; ++i) { x[i] /= y[i]; }
+        return vld1q_f32(x);
+    #endif
+    }
+    static inline FloatN floatNRcp(FloatN v) {
+        FloatN r = vrecpeq_f32(v);
+        return vmulq_f32(r, vrecpsq_f32(v, r));
+    }
+    static inline FloatN floatNLoad(const float* p) { return vld1q_f32(p); }
+    static inline void floatNStore(float* p, FloatN v) { vst1q_f32(p, v); }
+#else
+    #define SIMD_WIDTH 1
+    typedef float FloatN;
+
+    static inline FloatN floatNSet(float v) { return v; }
+    static inline FloatN floatNRamp(float start) { return start; }
+    static inline FloatN floatNAdd(FloatN a, FloatN b) { return a + b; }
+    static inline FloatN floatNSub(FloatN a, FloatN b) { return a - b; }
+    static inline FloatN floatNMul(FloatN a, FloatN b) { return a * b; }
+    static inline FloatN floatNDiv(FloatN a, FloatN b) { return a / b; }
+    static inline FloatN floatNRcp(FloatN v) { return 1 / v; }
+    static inline FloatN floatNLoad(const float* p) { return *p; }
+    static inline void floatNStore(float* p, FloatN v) { *p = v; }
+#endif
+
+/**
+ * Approximate reciprocal, refined by a single Newton step
+ *
+ * @param v Value, not zero
+ * @return Approximation of 1 / v
+ */
+static inline float rcpFast(float v) {
+#if defined(__SSE2__) || defined(_M_X64)
+    float r = _mm_cvtss_f32(_mm_rcp_ss(_mm_set_ss(v)));
+    return r * (2 - v * r);
+#elif defined(__ARM_NEON)
+    float32x2_t value = vdup_n_f32(v);
+    float32x2_t r = vrecpe_f32(value);
+    return vget_lane_f32(vmul_f32(r, vrecps_f32(value, r)), 0);
+#else
+    return 1 / v;
+#endif
+}
+
+/**
+ * Approximate reciprocal square root, refined by a single Newton step
+ *
+ * @param v Value, greater than zero
+ * @return Approximation of 1 / sqrt(v)
+ */
+static inline float rsqrtFast(float v) {
+#if defined(__SSE2__) || defined(_M_X64)
+    float r = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(v)));
+    return r * (1.5f - .5f * v * r * r);
+#elif defined(__ARM_NEON)
+    float32x2_t value = vdup_n_f32(v);
+    float32x2_t r = vrsqrte_f32(value);
+    return vget_lane_f32(vmul_f32(r, vrsqrts_f32(vmul_f32(value, r), r)), 0);
+#else
+    return 1 / sqrtf(v);
+#endif
+}
+
 /**
  * Subtract two vectors
  *
@@ -34,7 +182,13 @@ typedef struct { Vector4 p1, p2, p3, p4; } Matrix4x4;
  * @param v2 Vector2
  * @return Result vector
  */
-Vector3 subVec3(const Vector3* v1, const Vector3* v2);
+static inline Vector3 subVec3(const Vector3* v1, const Vector3* v2) {
+    return (Vector3){
+        .x = v1->x - v2->x,
+        .y = v1->y - v2->y,
+        .z = v1->z - v2->z
+    };
+}
 
 /**
  * Calculate the dot product two vectors
@@ -43,15 +197,41 @@ Vector3 subVec3(const Vector3* v1, const Vector3* v2);
  * @param v2 Vector2
  * @return Dot product
  */
-float dotVec3(const Vector3* v1, const Vector3* v2);
+static inline float dotVec3(const Vector3* v1, const Vector3* v2) {
+    return v1->x * v2->x + v1->y * v2->y + v1->z * v2->z;
+}
+
+/**
+ * Calculate the length of a vector
+ *
+ * @param v Vector
+ * @return Length of the vector
+ */
+static inline float lenVec3(const Vector3* v) {
+    return sqrtf(v->x * v->x + v->y * v->y + v->z * v->z);
+}
 
 /**
  * Normalize the vector using the length of a vector
  *
  * @param v Vector to normalize
- * @return Normalized vector
+ * @return Normalized vector, a zero vector when the vector has no (or an invalid) length
  */
-Vector3 normalizeVec3(const Vector3* v);
+static inline Vector3 normalizeVec3(const Vector3* v) {
+#if FAST_MATH
+    float lengthSquared = v->x * v->x + v->y * v->y + v->z * v->z;
+    float s = lengthSquared > 0 ? rsqrtFast(lengthSquared) : 0;
+#else
+    float l = lenVec3(v);
+    float s = l > 0 ? 1 / l : 0;
+#endif
+
+    return (Vector3) {
+        .x = v->x * s,
+        .y = v->y * s,
+        .z = v->z * s
+    };
+}
 
 /**
  * Calculate the cross product of two vectors
@@ -60,7 +240,13 @@ Vector3 normalizeVec3(const Vector3* v);
  * @param v2 Vector2
  * @return Vector cross product
  */
-Vector3 crossVec3(const Vector3* v1, const Vector3* v2);
+static inline Vector3 crossVec3(const Vector3* v1, const Vector3* v2) {
+    return (Vector3) {
+        .x = v1->y * v2->z - v1->z * v2->y,
+        .y = v1->z * v2->x - v1->x * v2->z,
+        .z = v1->x * v2->y - v1->y * v2->x
+    };
+}
 
 /**
  * Transform vector3 using a transformation matrix
@@ -69,7 +255,116 @@ Vector3 crossVec3(const Vector3* v1, const Vector3* v2);
  * @param mat Transformation matrix
  * @return Transformed vector
  */
-Vector3 transformVec3(const Vector3* v, const Matrix4x4* mat);
+static inline Vector3 transformVec3(const Vector3* v, const Matrix4x4* mat) {
+    return (Vector3) {
+        .x = mat->p1.x * v->x + mat->p2.x * v->y + mat->p3.x * v->z + mat->p4.x,
+        .y = mat->p1.y * v->x + mat->p2.y * v->y + mat->p3.y * v->z + mat->p4.y,
+        .z = mat->p1.z * v->x + mat->p2.z * v->y + mat->p3.z * v->z + mat->p4.z
+    };
+}
+
+/**
+ * Transform vectors stored as separate x, y and z arrays, SIMD_WIDTH vectors at a time
+ *
+ * Every vector is computed using the same operations as transformVec3, the results are identical to
+ * transforming the vectors one by one. The destinations may be the source arrays.
+ *
+ * @param x X components of the vectors to transform
+ * @param y Y components of the vectors to transform
+ * @param z Z components of the vectors to transform
+ * @param count Count of vectors
+ * @param mat Transformation matrix
+ * @param outX Destination of the x components of the transformed vectors
+ * @param outY Destination of the y components of the transformed vectors
+ * @param outZ Destination of the z components of the transformed vectors
+ */
+static inline void transformVec3Batch(const float* x, const float* y, const float* z, unsigned int count, const Matrix4x4* mat,
+        float* outX, float* outY, float* outZ) {
+    const float m[12] = {
+        mat->p1.x, mat->p2.x, mat->p3.x, mat->p4.x,
+        mat->p1.y, mat->p2.y, mat->p3.y, mat->p4.y,
+        mat->p1.z, mat->p2.z, mat->p3.z, mat->p4.z
+    };
+    float* out[3] = { outX, outY, outZ };
+    unsigned int i = 0;
+
+    for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+        FloatN vx = floatNLoad(x + i);
+        FloatN vy = floatNLoad(y + i);
+        FloatN vz = floatNLoad(z + i);
+
+        for (int k = 0; k < 3; ++k) {
+            const float* row = m + k * 4;
+            FloatN v = floatNAdd(floatNMul(floatNSet(row[0]), vx), floatNMul(floatNSet(row[1]), vy));
+            v = floatNAdd(floatNAdd(v, floatNMul(floatNSet(row[2]), vz)), floatNSet(row[3]));
+            floatNStore(out[k] + i, v);
+        }
+    }
+
+    for (; i < count; ++i) {
+        Vector3 v = { x[i], y[i], z[i] };
+        Vector3 t = transformVec3(&v, mat);
+        outX[i] = t.x;
+        outY[i] = t.y;
+        outZ[i] = t.z;
+    }
+}
+
+/**
+ * Multiply two transformation matrices
+ *
+ * @param m1 Transformation which is applied first
+ * @param m2 Transformation which is applied second
+ * @return Transformation applying m1 followed by m2
+ */
+static inline Matrix4x4 mulMatrix4x4(const Matrix4x4* m1, const Matrix4x4* m2) {
+    const Vector4* rows[4] = { &m1->p1, &m1->p2, &m1->p3, &m1->p4 };
+    Vector4 result[4];
+
+    for (int i = 0; i < 4; ++i) {
+        const Vector4* r = rows[i];
+        result[i] = (Vector4) {
+            .x = r->x * m2->p1.x + r->y * m2->p2.x + r->z * m2->p3.x + r->w * m2->p4.x,
+            .y = r->x * m2->p1.y + r->y * m2->p2.y + r->z * m2->p3.y + r->w * m2->p4.y,
+            .z = r->x * m2->p1.z + r->y * m2->p2.z + r->z * m2->p3.z + r->w * m2->p4.z,
+            .w = r->x * m2->p1.w + r->y * m2->p2.w + r->z * m2->p3.w + r->w * m2->p4.w
+        };
+    }
+
+    return (Matrix4x4) { result[0], result[1], result[2], result[3] };
+}
+
+/**
+ * Invert an affine transformation matrix (rotation, scale and translation, as used by transformVec3)
+ *
+ * @param m Transformation to invert
+ * @return Inverse transformation, a zero matrix when the transformation is not invertible
+ */
+static inline Matrix4x4 invertAffineMatrix4x4(const Matrix4x4* m) {
+    float a = m->p1.x, b = m->p1.y, c = m->p1.z;
+    float d = m->p2.x, e = m->p2.y, f = m->p2.z;
+    float g = m->p3.x, h = m->p3.y, i = m->p3.z;
+
+    float determinant = a * (e * i - f * h) - b * (d * i - f * g) + c * (d * h - e * g);
+    if (determinant == 0)
+        return (Matrix4x4) { { 0 } };
+
+    float s = 1 / determinant;
+    Vector4 p1 = { (e * i - f * h) * s, (c * h - b * i) * s, (b * f - c * e) * s, 0 };
+    Vector4 p2 = { (f * g - d * i) * s, (a * i - c * g) * s, (c * d - a * f) * s, 0 };
+    Vector4 p3 = { (d * h - e * g) * s, (b * g - a * h) * s, (a * e - b * d) * s, 0 };
+
+    // The translation is moved back through the inverted linear part
+    const Vector4* t = &m->p4;
+    Vector4 p4 = {
+        -(t->x * p1.x + t->y * p2.x + t->z * p3.x),
+        -(t->x * p1.y + t->y * p2.y + t->z * p3.y),
+        -(t->x * p1.z + t->y * p2.z + t->z * p3.z),
+        1
+    };
+
+    return (Matrix4x4) { p1, p2, p3, p4 };
+}
 
 /**
  * This functions is used to determine weather a point is
@@ -85,6 +380,38 @@ Vector3 transformVec3(const Vector3* v, const Matrix4x4* mat);
  *         If the value < 0, the value is on the left of the line.
  *         Otherwise the value is on the right of the line.
  */
-float edgeFunction(const Vector3* v1, const Vector3* v2, const Vector3* p);
+static inline float edgeFunction(const Vector3* v1, const Vector3* v2, const Vector3* p) {
+    return (p->x - v1->x) * (v2->y - v1->y) - (p->y - v1->y) * (v2->x - v1->x);
+}
+
+/**
+ * Evaluate the edge function for a row of points, SIMD_WIDTH points at a time
+ *
+ * The points are x, x + 1, ... x + count - 1 on row y. Every point is computed using the same operations
+ * as edgeFunction, the results are identical to evaluating the points one by one.
+ *
+ * @param v1 Edge starting point vector
+ * @param v2 Edge ending point vector
+ * @param x Horizontal position of the first point, an integer
+ * @param y Vertical position of the points
+ * @param count Count of points
+ * @param out Destination of the edge function of each point
+ */
+static inline void edgeFunctionRow(const Vector3* v1, const Vector3* v2, float x, float y, unsigned int count, float* out) {
+    FloatN originX = floatNSet(v1->x);
+    FloatN edgeY = floatNSet(v2->y - v1->y);
+    FloatN row = floatNSet((y - v1->y) * (v2->x - v1->x));
+    unsigned int i = 0;
+
+    for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+        FloatN px = floatNRamp(x + (float)i);
+        floatNStore(out + i, floatNSub(floatNMul(floatNSub(px, originX), edgeY), row));
+    }
+
+    for (; i < count; ++i) {
+        Vector3 p = { x + (float)i, y, 0 };
+        out[i] = edgeFunction(v1, v2, &p);
+    }
+}
 
 #endif //RASTERIZER_UTILS_H
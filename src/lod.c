@@ -0,0 +1,572 @@
+#include <math.h>
+#include <memory.h>
+#include <stdlib.h>
+#include "include/lod.h"
+
+/**
+ * Weight of the planes which are placed perpendicular to open edges,
+ * high enough to keep the outline of the mesh in place.
+ */
+#define BOUNDARY_WEIGHT 1000.
+
+/**
+ * Symmetric 4x4 matrix storing the sum of squared plane distances,
+ * the upper triangle is stored as: aa ab ac ad bb bc bd cc cd dd
+ */
+typedef struct { double m[10]; } Quadric;
+
+/**
+ * Candidate edge collapse stored inside of the heap
+ *
+ * The stamps of both vertices at the time of computation are stored as well, when
+ * one of the vertices changed afterwards the candidate is outdated.
+ */
+typedef struct {
+    double cost;
+    Vector3 target;
+    unsigned int v1, v2;
+    unsigned int s1, s2;
+} Collapse;
+
+typedef struct {
+    unsigned int* items;
+    unsigned int count;
+    unsigned int capacity;
+} TriangleList;
+
+typedef struct {
+    unsigned int key1, key2;
+    unsigned int triangle;
+} Edge;
+
+typedef struct {
+    unsigned int vertexCount;
+    Vector3* positions;
+    Quadric* quadrics;
+    unsigned int* stamps;
+    unsigned int* marks;
+    unsigned int pass;
+    unsigned char* removed;
+    TriangleList* adjacency;
+
+    unsigned int triangleCount;
+    unsigned int aliveCount;
+    unsigned int (*triangles)[3];
+    unsigned char* dead;
+
+    Collapse* heap;
+    unsigned int heapCount;
+    unsigned int heapCapacity;
+
+    const float* attributes;
+    unsigned int attributeCount;
+} Simplifier;
+
+static void addPlane(Quadric* q, double a, double b, double c, double d, double weight) {
+    q->m[0] += weight * a * a; q->m[1] += weight * a * b; q->m[2] += weight * a * c; q->m[3] += weight * a * d;
+    q->m[4] += weight * b * b; q->m[5] += weight * b * c; q->m[6] += weight * b * d;
+    q->m[7] += weight * c * c; q->m[8] += weight * c * d;
+    q->m[9] += weight * d * d;
+}
+
+static double quadricError(const Quadric* q, const Vector3* v) {
+    double x = v->x, y = v->y, z = v->z;
+    const double* m = q->m;
+    return m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x
+         + m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y
+         + m[7] * z * z + 2 * m[8] * z
+         + m[9];
+}
+
+/**
+ * Find the position with the lowest error by solving the 3x3 linear system of the quadric
+ *
+ * @param q Quadric to minimize
+ * @param v Resulting position
+ * @return Zero when the system is singular (flat or linear neighbourhood), otherwise non zero
+ */
+static int quadricOptimum(const Quadric* q, Vector3* v) {
+    const double* m = q->m;
+    double det = m[0] * (m[4] * m[7] - m[5] * m[5])
+               - m[1] * (m[1] * m[7] - m[5] * m[2])
+               + m[2] * (m[1] * m[5] - m[4] * m[2]);
+
+    // The threshold is relative to the scale of the quadric, as small triangles produce small quadrics
+    double trace = m[0] + m[4] + m[7];
+    if (fabs(det) <= 1e-8 * trace * trace * trace)
+        return 0;
+
+    // Cramer's rule on A * v = -b
+    double bx = -m[3], by = -m[6], bz = -m[8];
+    double s = 1 / det;
+
+    v->x = (float)(s * (bx * (m[4] * m[7] - m[5] * m[5]) - m[1] * (by * m[7] - m[5] * bz) + m[2] * (by * m[5] - m[4] * bz)));
+    v->y = (float)(s * (m[0] * (by * m[7] - bz * m[5]) - bx * (m[1] * m[7] - m[5] * m[2]) + m[2] * (m[1] * bz - by * m[2])));
+    v->z = (float)(s * (m[0] * (m[4] * bz - m[5] * by) - m[1] * (m[1] * bz - by * m[2]) + bx * (m[1] * m[5] - m[4] * m[2])));
+    return 1;
+}
+
+static Vector3 triangleNormal(const Vector3* p0, const Vector3* p1, const Vector3* p2) {
+    Vector3 line1 = subVec3(p1, p0);
+    Vector3 line2 = subVec3(p2, p0);
+    return crossVec3(&line1, &line2);
+}
+
+static void pushTriangle(TriangleList* list, unsigned int triangle) {
+    if (list->count == list->capacity) {
+        list->capacity = MAX(4, list->capacity * 2);
+        list->items = realloc(list->items, list->capacity * sizeof(unsigned int));
+    }
+    list->items[list->count++] = triangle;
+}
+
+static void pushCollapse(Simplifier* s, const Collapse* c) {
+    if (s->heapCount == s->heapCapacity) {
+        s->heapCapacity = MAX(64, s->heapCapacity * 2);
+        s->heap = realloc(s->heap, s->heapCapacity * sizeof(Collapse));
+    }
+
+    // Sift up
+    unsigned int i = s->heapCount++;
+    while (i > 0) {
+        unsigned int parent = (i - 1) / 2;
+        if (s->heap[parent].cost <= c->cost)
+            break;
+        s->heap[i] = s->heap[parent];
+        i = parent;
+    }
+    s->heap[i] = *c;
+}
+
+static Collapse popCollapse(Simplifier* s) {
+    Collapse top = s->heap[0];
+    Collapse last = s->heap[--s->heapCount];
+
+    // Sift down
+    unsigned int i = 0;
+    for (;;) {
+        unsigned int child = i * 2 + 1;
+        if (child >= s->heapCount)
+            break;
+        if (child + 1 < s->heapCount && s->heap[child + 1].cost < s->heap[child].cost)
+            child++;
+        if (last.cost <= s->heap[child].cost)
+            break;
+        s->heap[i] = s->heap[child];
+        i = child;
+    }
+    if (s->heapCount > 0)
+        s->heap[i] = last;
+    return top;
+}
+
+static void computeCollapse(Simplifier* s, unsigned int v1, unsigned int v2) {
+    Quadric q = s->quadrics[v1];
+    for (int i = 0; i < 10; ++i) { q.m[i] += s->quadrics[v2].m[i]; }
+
+    Collapse c = { .v1 = v1, .v2 = v2, .s1 = s->stamps[v1], .s2 = s->stamps[v2] };
+
+    const Vector3* p1 = &s->positions[v1];
+    const Vector3* p2 = &s->positions[v2];
+    Vector3 edge = subVec3(p2, p1);
+
+    /*
+     * Nearly singular systems can place the optimum far away from the edge,
+     * such a position is rejected in favour of a position on the edge.
+     */
+    int solved = quadricOptimum(&q, &c.target);
+    if (solved) {
+        Vector3 d1 = subVec3(&c.target, p1);
+        solved = dotVec3(&d1, &d1) <= 4 * dotVec3(&edge, &edge);
+    }
+
+    if (solved) {
+        c.cost = quadricError(&q, &c.target);
+    }
+    else {
+        // Fall back to the best of both end points and the mid point
+        Vector3 candidates[3] = {
+            *p1,
+            *p2,
+            { (p1->x + p2->x) * .5f, (p1->y + p2->y) * .5f, (p1->z + p2->z) * .5f }
+        };
+
+        c.cost = INFINITY;
+        for (int i = 0; i < 3; ++i) {
+            double cost = quadricError(&q, &candidates[i]);
+            if (cost < c.cost) {
+                c.cost = cost;
+                c.target = candidates[i];
+            }
+        }
+    }
+
+    c.cost = MAX(0, c.cost);
+    pushCollapse(s, &c);
+}
+
+/**
+ * Test if moving a vertex to the collapse target would flip any of its triangles
+ *
+ * Triangles shared by both collapse vertices are ignored as those are removed by the collapse.
+ */
+static int collapseFlips(const Simplifier* s, unsigned int v, unsigned int other, const Vector3* target) {
+    const TriangleList* list = &s->adjacency[v];
+    for (unsigned int i = 0; i < list->count; ++i) {
+        unsigned int t = list->items[i];
+        if (s->dead[t])
+            continue;
+
+        const unsigned int* tri = s->triangles[t];
+        if (tri[0] == other || tri[1] == other || tri[2] == other)
+            continue;
+
+        Vector3 p[3];
+        for (int k = 0; k < 3; ++k) { p[k] = tri[k] == v ? *target : s->positions[tri[k]]; }
+
+        Vector3 before = triangleNormal(&s->positions[tri[0]], &s->positions[tri[1]], &s->positions[tri[2]]);
+        Vector3 after = triangleNormal(&p[0], &p[1], &p[2]);
+        if (dotVec3(&before, &after) <= 0)
+            return 1;
+    }
+    return 0;
+}
+
+static void collapseEdge(Simplifier* s, const Collapse* c) {
+    unsigned int keep = c->v1;
+    unsigned int drop = c->v2;
+
+    s->positions[keep] = c->target;
+    for (int i = 0; i < 10; ++i) { s->quadrics[keep].m[i] += s->quadrics[drop].m[i]; }
+    s->stamps[keep]++;
+    s->removed[drop] = 1;
+    s->pass++;
+
+    TriangleList* dropList = &s->adjacency[drop];
+    for (unsigned int i = 0; i < dropList->count; ++i) {
+        unsigned int t = dropList->items[i];
+        if (s->dead[t])
+            continue;
+
+        unsigned int* tri = s->triangles[t];
+        if (tri[0] == keep || tri[1] == keep || tri[2] == keep) {
+            s->dead[t] = 1;
+            s->aliveCount--;
+            continue;
+        }
+
+        for (int k = 0; k < 3; ++k) {
+            if (tri[k] == drop)
+                tri[k] = keep;
+        }
+        pushTriangle(&s->adjacency[keep], t);
+    }
+    free(dropList->items);
+    *dropList = (TriangleList){ 0 };
+
+    // Compact the triangle list of the kept vertex and push its updated edges
+    TriangleList* keepList = &s->adjacency[keep];
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < keepList->count; ++i) {
+        unsigned int t = keepList->items[i];
+        if (s->dead[t])
+            continue;
+        keepList->items[count++] = t;
+
+        for (int k = 0; k < 3; ++k) {
+            unsigned int v = s->triangles[t][k];
+            if (v == keep || s->marks[v] == s->pass)
+                continue;
+            s->marks[v] = s->pass;
+            computeCollapse(s, keep, v);
+        }
+    }
+    keepList->count = count;
+}
+
+static int compareEdges(const void* a, const void* b) {
+    const Edge* e1 = a;
+    const Edge* e2 = b;
+    if (e1->key1 != e2->key1)
+        return e1->key1 < e2->key1 ? -1 : 1;
+    if (e1->key2 != e2->key2)
+        return e1->key2 < e2->key2 ? -1 : 1;
+    return 0;
+}
+
+/**
+ * Add perpendicular planes to the quadrics of open edges, which are edges used by a single triangle
+ */
+static void addBoundaryQuadrics(Simplifier* s) {
+    unsigned int edgeCount = s->triangleCount * 3;
+    Edge* edges = malloc(edgeCount * sizeof(Edge));
+
+    for (unsigned int t = 0; t < s->triangleCount; ++t) {
+        for (int k = 0; k < 3; ++k) {
+            unsigned int a = s->triangles[t][k];
+            unsigned int b = s->triangles[t][(k + 1) % 3];
+            edges[t * 3 + k] = (Edge){ MIN(a, b), MAX(a, b), t };
+        }
+    }
+    qsort(edges, edgeCount, sizeof(Edge), compareEdges);
+
+    for (unsigned int i = 0; i < edgeCount; ++i) {
+        if ((i > 0 && compareEdges(&edges[i - 1], &edges[i]) == 0) ||
+            (i + 1 < edgeCount && compareEdges(&edges[i + 1], &edges[i]) == 0))
+            continue;
+
+        const unsigned int* tri = s->triangles[edges[i].triangle];
+        const Vector3* p1 = &s->positions[edges[i].key1];
+        const Vector3* p2 = &s->positions[edges[i].key2];
+
+        Vector3 normal = triangleNormal(&s->positions[tri[0]], &s->positions[tri[1]], &s->positions[tri[2]]);
+        Vector3 direction = subVec3(p2, p1);
+        Vector3 plane = crossVec3(&direction, &normal);
+
+        double length = sqrt(dotVec3(&plane, &plane));
+        if (length <= 0)
+            continue;
+
+        double a = plane.x / length, b = plane.y / length, c = plane.z / length;
+        double d = -(a * p1->x + b * p1->y + c * p1->z);
+        double weight = BOUNDARY_WEIGHT * dotVec3(&direction, &direction);
+
+        addPlane(&s->quadrics[edges[i].key1], a, b, c, d, weight);
+        addPlane(&s->quadrics[edges[i].key2], a, b, c, d, weight);
+    }
+    free(edges);
+}
+
+static void initSimplifier(Simplifier* s, const Vector3* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indicesCount) {
+    memset(s, 0, sizeof(Simplifier));
+
+    s->vertexCount = vertexCount;
+    s->positions = malloc(vertexCount * sizeof(Vector3));
+    s->quadrics = calloc(vertexCount, sizeof(Quadric));
+    s->stamps = calloc(vertexCount, sizeof(unsigned int));
+    s->marks = calloc(vertexCount, sizeof(unsigned int));
+    s->removed = calloc(vertexCount, sizeof(unsigned char));
+    s->adjacency = calloc(vertexCount, sizeof(TriangleList));
+    memcpy(s->positions, vertices, vertexCount * sizeof(Vector3));
+
+    s->triangleCount = indicesCount / 3;
+    s->aliveCount = s->triangleCount;
+    s->triangles = malloc(s->triangleCount * sizeof(*s->triangles));
+    s->dead = calloc(s->triangleCount, sizeof(unsigned char));
+
+    // Convert to zero based indices and accumulate the triangle plane quadrics
+    for (unsigned int t = 0; t < s->triangleCount; ++t) {
+        unsigned int* tri = s->triangles[t];
+        for (int k = 0; k < 3; ++k) {
+            tri[k] = indices[t * 3 + k] - 1;
+            pushTriangle(&s->adjacency[tri[k]], t);
+        }
+
+        Vector3 normal = triangleNormal(&s->positions[tri[0]], &s->positions[tri[1]], &s->positions[tri[2]]);
+        double length = sqrt(dotVec3(&normal, &normal));
+        if (length <= 0) {
+            continue;
+        }
+
+        // Weight the plane by the triangle area
+        double a = normal.x / length, b = normal.y / length, c = normal.z / length;
+        double d = -(a * s->positions[tri[0]].x + b * s->positions[tri[0]].y + c * s->positions[tri[0]].z);
+        for (int k = 0; k < 3; ++k) { addPlane(&s->quadrics[tri[k]], a, b, c, d, length * .5); }
+    }
+
+    addBoundaryQuadrics(s);
+
+    for (unsigned int t = 0; t < s->triangleCount; ++t) {
+        for (int k = 0; k < 3; ++k) {
+            unsigned int a = s->triangles[t][k];
+            unsigned int b = s->triangles[t][(k + 1) % 3];
+            if (a < b)
+                computeCollapse(s, a, b);
+        }
+    }
+}
+
+static void freeSimplifier(Simplifier* s) {
+    for (unsigned int i = 0; i < s->vertexCount; ++i) { free(s->adjacency[i].items); }
+
+    free(s->positions);
+    free(s->quadrics);
+    free(s->stamps);
+    free(s->marks);
+    free(s->removed);
+    free(s->adjacency);
+    free(s->triangles);
+    free(s->dead);
+    free(s->heap);
+}
+
+static void simplify(Simplifier* s, unsigned int targetCount) {
+    while (s->aliveCount > targetCount && s->heapCount > 0) {
+        Collapse c = popCollapse(s);
+
+        if (s->removed[c.v1] || s->removed[c.v2] || s->stamps[c.v1] != c.s1 || s->stamps[c.v2] != c.s2)
+            continue;
+
+        if (collapseFlips(s, c.v1, c.v2, &c.target) || collapseFlips(s, c.v2, c.v1, &c.target))
+            continue;
+
+        collapseEdge(s, &c);
+    }
+}
+
+/**
+ * Copy the alive triangles of the simplifier into a compact mesh
+ */
+static void extractMesh(const Simplifier* s, const Mesh* source, Mesh* mesh) {
+    unsigned int* remap = calloc(s->vertexCount, sizeof(unsigned int));
+    unsigned int capacity = MIN(s->vertexCount, s->aliveCount * 3);
+
+    *mesh = *source;
+    mesh->vertexCount = 0;
+    mesh->indicesCount = 0;
+    mesh->indices = malloc(s->aliveCount * 3 * sizeof(unsigned int));
+    mesh->vertices = malloc(capacity * sizeof(Vector3));
+    mesh->attributes = s->attributes ? malloc((size_t)capacity * s->attributeCount * sizeof(float)) : NULL;
+
+    for (unsigned int t = 0; t < s->triangleCount; ++t) {
+        if (s->dead[t])
+            continue;
+
+        for (int k = 0; k < 3; ++k) {
+            unsigned int v = s->triangles[t][k];
+            if (remap[v] == 0) {
+                mesh->vertices[mesh->vertexCount] = s->positions[v];
+                if (s->attributes) {
+                    memcpy(mesh->attributes + (size_t)mesh->vertexCount * s->attributeCount,
+                           s->attributes + (size_t)v * s->attributeCount,
+                           s->attributeCount * sizeof(float));
+                }
+                remap[v] = ++mesh->vertexCount;
+            }
+            mesh->indices[mesh->indicesCount++] = remap[v];
+        }
+    }
+    free(remap);
+}
+
+unsigned int generateLodChain(const Mesh* mesh, unsigned int levelCount, LodChain* chain) {
+    const Vector3* vertices = mesh->vertices;
+    unsigned int vertexCount = mesh->vertexCount;
+
+    memset(chain, 0, sizeof(LodChain));
+    levelCount = MIN(levelCount, LOD_MAX_LEVELS);
+    if (levelCount == 0 || vertexCount == 0)
+        return 0;
+
+    // Bounding sphere around the center of the bounding box
+    Vector3 min = vertices[0];
+    Vector3 max = vertices[0];
+    for (unsigned int i = 1; i < vertexCount; ++i) {
+        min = (Vector3){ MIN(min.x, vertices[i].x), MIN(min.y, vertices[i].y), MIN(min.z, vertices[i].z) };
+        max = (Vector3){ MAX(max.x, vertices[i].x), MAX(max.y, vertices[i].y), MAX(max.z, vertices[i].z) };
+    }
+
+    chain->center = (Vector3){ (min.x + max.x) * .5f, (min.y + max.y) * .5f, (min.z + max.z) * .5f };
+    for (unsigned int i = 0; i < vertexCount; ++i) {
+        Vector3 d = subVec3(&vertices[i], &chain->center);
+        chain->radius = MAX(chain->radius, sqrtf(dotVec3(&d, &d)));
+    }
+
+    // The first level is an unmodified copy of the mesh
+    Mesh* base = &chain->levels[0];
+    *base = *mesh;
+    base->vertices = malloc(vertexCount * sizeof(Vector3));
+    base->indices = malloc(mesh->indicesCount * sizeof(unsigned int));
+    memcpy(base->vertices, vertices, vertexCount * sizeof(Vector3));
+    memcpy(base->indices, mesh->indices, mesh->indicesCount * sizeof(unsigned int));
+
+    if (mesh->attributes) {
+        base->attributes = malloc((size_t)vertexCount * mesh->attributeCount * sizeof(float));
+        memcpy(base->attributes, mesh->attributes, (size_t)vertexCount * mesh->attributeCount * sizeof(float));
+    }
+    chain->levelCount = 1;
+
+    if (levelCount == 1)
+        return 1;
+
+    /*
+     * A single simplifier is used for the whole chain, this keeps the accumulated quadrics of
+     * earlier collapses so the error of each level is measured against the original surface.
+     */
+    Simplifier s;
+    initSimplifier(&s, vertices, vertexCount, mesh->indices, mesh->indicesCount);
+    s.attributes = mesh->attributes;
+    s.attributeCount = mesh->attributeCount;
+
+    while (chain->levelCount < levelCount) {
+        unsigned int previous = s.aliveCount;
+        simplify(&s, (unsigned int)((float)previous * LOD_REDUCTION));
+
+        // Stop when the mesh can not be simplified any further
+        if (s.aliveCount == previous || s.aliveCount == 0)
+            break;
+
+        extractMesh(&s, mesh, &chain->levels[chain->levelCount++]);
+    }
+
+    freeSimplifier(&s);
+    return chain->levelCount;
+}
+
+void freeLodChain(LodChain* chain) {
+    for (unsigned int i = 0; i < chain->levelCount; ++i) {
+        free(chain->levels[i].vertices);
+        free(chain->levels[i].indices);
+        free(chain->levels[i].attributes);
+    }
+    memset(chain, 0, sizeof(LodChain));
+}
+
+const Mesh* selectLod(
+        const LodChain* chain,
+        const Matrix4x4* modelViewProjection,
+        const RenderTarget* target,
+        const PipelineState* state) {
+
+    const Mesh* selected = &chain->levels[0];
+    if (chain->levelCount <= 1)
+        return selected;
+
+    // The largest axis scale of the matrix is used to scale the radius
+    const Matrix4x4* m = modelViewProjection;
+    float scale = sqrtf(MAX3(
+        m->p1.x * m->p1.x + m->p1.y * m->p1.y + m->p1.z * m->p1.z,
+        m->p2.x * m->p2.x + m->p2.y * m->p2.y + m->p2.z * m->p2.z,
+        m->p3.x * m->p3.x + m->p3.y * m->p3.y + m->p3.z * m->p3.z));
+
+    Vector3 center = transformVec3(&chain->center, modelViewProjection);
+    float radius = chain->radius * scale;
+    float near = target->nearClipping;
+
+    if (-center.z - radius <= near)
+        return selected;
+
+    float fW = (float)target->width;
+    float fH = (float)target->height;
+
+    float wAspect;
+    float hAspect;
+    viewAspect(state ? state->deviceAspect : DEVICE_ASPECT, target->width, target->height, &wAspect, &hAspect);
+
+    // The radius is measured in pixels along both axes at the depth of the center
+    Vector3 right = { center.x + radius, center.y, center.z };
+    Vector3 up = { center.x, center.y + radius, center.z };
+    Vector3 rasterCenter = cameraToRaster(&center, fW, fH, wAspect, hAspect, near);
+    Vector3 rasterRight = cameraToRaster(&right, fW, fH, wAspect, hAspect, near);
+    Vector3 rasterUp = cameraToRaster(&up, fW, fH, wAspect, hAspect, near);
+
+    float pixelRadius = MAX(rasterRight.x - rasterCenter.x, rasterCenter.y - rasterUp.y);
+    float area = 3.14159265f * pixelRadius * pixelRadius;
+
+    for (unsigned int i = 0; i < chain->levelCount; ++i) {
+        selected = &chain->levels[i];
+        if (area >= (float)(selected->indicesCount / 3) * LOD_TRIANGLE_PIXELS)
+            break;
+    }
+    return selected;
+}
@@ -0,0 +1,193 @@
+#if !defined(_WIN32)
+    #define _DEFAULT_SOURCE
+#endif
+
+#include <stdlib.h>
+#include "include/processes.h"
+#include "include/threads.h"
+
+#if !defined(_WIN32)
+    #include <sys/mman.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+
+    #if !defined(MAP_ANONYMOUS)
+        #define MAP_ANONYMOUS MAP_ANON
+    #endif
+#endif
+
+/**
+ * Get the size of the buffers of a render target
+ *
+ * @param target Render target with its formats and sample count set
+ * @param depth Non zero for the size of the zBuffer, otherwise the size of the frameBuffer
+ * @return Size in bytes
+ */
+static size_t targetBufferSize(const RenderTarget* target, int depth) {
+    size_t elements = renderTargetPixelCount(target) * target->sampleCount;
+    return elements * (depth ? depthFormatSize(target->depthFormat) : colorFormatSize(target->colorFormat));
+}
+
+/**
+ * Get the rows of a worker, every worker draws a strip of whole tile rows
+ *
+ * @param target Render target to draw into
+ * @param worker Index of the worker
+ * @param workerCount Count of workers
+ * @param scissor Scissor rectangle of the draw, NULL for the complete target
+ * @param rect Rectangle of the worker inside of the scissor rectangle
+ * @return Zero when the strip of the worker is outside of the scissor rectangle, otherwise non zero
+ */
+static int workerRect(const RenderTarget* target, unsigned int worker, unsigned int workerCount, const Rect* scissor, Rect* rect) {
+    unsigned int tileRows = (target->height + (1u << TILE_SHIFT) - 1) >> TILE_SHIFT;
+    unsigned long long minY = ((unsigned long long)tileRows * worker / workerCount) << TILE_SHIFT;
+    unsigned long long maxY = MIN(((unsigned long long)tileRows * (worker + 1) / workerCount) << TILE_SHIFT, target->height);
+    unsigned long long minX = 0;
+    unsigned long long maxX = target->width;
+
+    if (scissor) {
+        minX = scissor->x;
+        maxX = MIN(maxX, (unsigned long long)scissor->x + scissor->width);
+        minY = MAX(minY, scissor->y);
+        maxY = MIN(maxY, (unsigned long long)scissor->y + scissor->height);
+    }
+
+    if (minX >= maxX || minY >= maxY)
+        return 0;
+
+    *rect = (Rect) { (unsigned int)minX, (unsigned int)minY, (unsigned int)(maxX - minX), (unsigned int)(maxY - minY) };
+    return 1;
+}
+
+void* allocateShared(size_t size) {
+#if defined(_WIN32)
+    return calloc(1, size);
+#else
+    // Anonymous shared mappings are zero filled and stay shared with every process forked afterwards
+    void* memory = mmap(NULL, MAX(1, size), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? NULL : memory;
+#endif
+}
+
+void freeShared(void* memory, size_t size) {
+    if (!memory)
+        return;
+
+#if defined(_WIN32)
+    free(memory);
+#else
+    munmap(memory, MAX(1, size));
+#endif
+}
+
+RenderTarget createSharedRenderTarget(
+        unsigned int width,
+        unsigned int height,
+        ColorFormat colorFormat,
+        DepthFormat depthFormat,
+        TargetLayout layout,
+        unsigned int sampleCount,
+        unsigned char backgroundColor) {
+
+    RenderTarget target = {
+        .backgroundColor = backgroundColor,
+        .width = width,
+        .height = height,
+        .colorFormat = colorFormat,
+        .depthFormat = depthFormat,
+        .layout = layout,
+        .sampleCount = sampleCount <= 1 ? 1 : sampleCount <= 4 ? 4 : 8,
+        .nearClipping = NEAR_CLIPPING,
+        .farClipping = FAR_CLIPPING
+    };
+
+    target.zBuffer = allocateShared(targetBufferSize(&target, 1));
+    if (colorFormat != COLOR_FORMAT_NONE)
+        target.frameBuffer = allocateShared(targetBufferSize(&target, 0));
+    return target;
+}
+
+void freeSharedRenderTarget(RenderTarget* target) {
+    freeShared(target->zBuffer, targetBufferSize(target, 1));
+    freeShared(target->frameBuffer, targetBufferSize(target, 0));
+    target->zBuffer = NULL;
+    target->frameBuffer = NULL;
+}
+
+int drawInstancesForked(const RenderTarget* target, const DrawList* drawList, unsigned int processCount) {
+    unsigned int hardwareThreads = hardwareThreadCount();
+    unsigned int tileRows = (target->height + (1u << TILE_SHIFT) - 1) >> TILE_SHIFT;
+    unsigned int workerCount = MIN(processCount ? processCount : hardwareThreads, MAX(1, tileRows));
+    PipelineState state = drawList->state ? *drawList->state : defaultPipelineState();
+
+    // The statistics of the workers are returned through shared memory as well
+    size_t statsSize = workerCount * sizeof(RasterStats);
+    RasterStats* workerStats = drawList->stats ? allocateShared(statsSize) : NULL;
+
+    // Every worker draws its strip using its own state, the strips are spread over the hardware threads
+    PipelineState* states = malloc(workerCount * sizeof(PipelineState));
+    Rect* rects = malloc(workerCount * sizeof(Rect));
+    DrawList* lists = malloc(workerCount * sizeof(DrawList));
+    for (unsigned int i = 0; i < workerCount; ++i) {
+        states[i] = state;
+        states[i].scissor = &rects[i];
+        lists[i] = *drawList;
+        lists[i].state = &states[i];
+        // The threads of a draw context do not exist in forked processes, workers start their own threads
+        lists[i].context = NULL;
+        lists[i].threadCount = drawList->threadCount ? drawList->threadCount : MAX(1, hardwareThreads / workerCount);
+        lists[i].stats = workerStats ? &workerStats[i] : NULL;
+
+        if (workerStats) {
+            workerStats[i].touchMap = drawList->stats->touchMap;
+            workerStats[i].depthMap = drawList->stats->depthMap;
+            workerStats[i].shadeMap = drawList->stats->shadeMap;
+        }
+    }
+
+    int success = 1;
+#if defined(_WIN32)
+    for (unsigned int i = 0; i < workerCount; ++i) {
+        if (workerRect(target, i, workerCount, state.scissor, &rects[i]))
+            drawInstances(target, &lists[i]);
+    }
+#else
+    pid_t* workers = malloc(workerCount * sizeof(pid_t));
+    for (unsigned int i = 0; i < workerCount; ++i) {
+        workers[i] = 0;
+        if (!workerRect(target, i, workerCount, state.scissor, &rects[i]))
+            continue;
+
+        // The worker exits right after its draw, without flushing the buffered output it shares with the caller
+        workers[i] = fork();
+        if (workers[i] == 0) {
+            drawInstances(target, &lists[i]);
+            _exit(0);
+        }
+    }
+
+    // Strips of workers which could not be forked are drawn while the other workers are running
+    for (unsigned int i = 0; i < workerCount; ++i) {
+        if (workers[i] < 0)
+            drawInstances(target, &lists[i]);
+    }
+
+    for (unsigned int i = 0; i < workerCount; ++i) {
+        int status;
+        if (workers[i] > 0 && (waitpid(workers[i], &status, 0) != workers[i] || !WIFEXITED(status) || WEXITSTATUS(status) != 0))
+            success = 0;
+    }
+
+    free(workers);
+#endif
+
+    if (workerStats) {
+        for (unsigned int i = 0; i < workerCount; ++i) { addRasterStats(drawList->stats, &workerStats[i]); }
+        freeShared(workerStats, statsSize);
+    }
+
+    free(lists);
+    free(rects);
+    free(states);
+    return success;
+}
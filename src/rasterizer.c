@@ -6,143 +6,2776 @@
 #include <memory.h>
 #include <stdlib.h>
 #include "include/rasterizer.h"
+#include "include/threads.h"
 
 /**
- * This functions translates a camera coordinate to raster space.
+ * Count of raster bands per thread, multiple bands per thread keep the work balanced when
+ * the triangles are not spread evenly over the image.
+ */
+#define BANDS_PER_THREAD 4
+
+/**
+ * Width of the span of covered pixels which are collected before they are shaded together
+ */
+#define FRAGMENT_BATCH 64
+
+/**
+ * Count of vertices which are transformed together, their components are gathered into arrays on the stack
+ */
+#define TRANSFORM_BATCH 64
+
+/**
+ * Cost of computing the covered span of a row, in pixel tests. Triangles whose bounding box wastes more
+ * pixel tests than the span computation of all their rows costs are traversed per scanline.
+ */
+#ifndef SCANLINE_ROW_COST
+    #define SCANLINE_ROW_COST 8
+#endif
+
+/**
+ * Largest width and height of the bounding box of a triangle which takes the small triangle path, the
+ * pixels of the box are stored as a mask of SMALL_TRIANGLE_SIZE * SMALL_TRIANGLE_SIZE bits
+ */
+#define SMALL_TRIANGLE_SIZE 4
+
+/**
+ * Planes a triangle is clipped against: the near plane and the four sides of the guard band
+ */
+#define CLIP_PLANE_COUNT 5
+
+/**
+ * Largest count of vertices of a clipped polygon, every plane adds at most a single vertex to a triangle
+ */
+#define CLIP_MAX_VERTICES (3 + CLIP_PLANE_COUNT)
+
+/**
+ * Sample positions relative to the pixel position of 4x and 8x multisampling, rotated grid patterns which
+ * match the standard sample patterns of Direct3D
+ */
+static const float SAMPLE_POSITIONS_4[4][2] = {
+    { -2 / 16.f, -6 / 16.f }, { 6 / 16.f, -2 / 16.f }, { -6 / 16.f, 2 / 16.f }, { 2 / 16.f, 6 / 16.f }
+};
+
+static const float SAMPLE_POSITIONS_8[8][2] = {
+    { 1 / 16.f, -3 / 16.f }, { -1 / 16.f, 3 / 16.f }, { 5 / 16.f, 1 / 16.f }, { -3 / 16.f, -5 / 16.f },
+    { -5 / 16.f, 5 / 16.f }, { -7 / 16.f, -1 / 16.f }, { 3 / 16.f, 7 / 16.f }, { 7 / 16.f, -7 / 16.f }
+};
+
+/**
+ * Inclusive pixel rectangle
+ */
+typedef struct { int minX, minY, maxX, maxY; } Bounds;
+
+/**
+ * Buffers which triangles are drawn into, either the render target itself or the local buffers of a tile
+ *
+ * Pixel x, y of the image is stored at x - originX, y - originY of the target.
+ */
+typedef struct {
+    const RenderTarget* target;
+    int originX;
+    int originY;
+} Surface;
+
+/**
+ * Reason a triangle was culled during setup, used to index the counters of the setup stage
+ */
+typedef enum {
+    CULL_NONE,
+    CULL_OUTSIDE,
+    CULL_ZERO_AREA,
+    CULL_BACK_FACING,
+    CULL_MISSED,
+    CULL_REASON_COUNT
+} CullReason;
+
+/**
+ * Triangle which passed the setup stage, the vertices index the transformed vertices of the frame
+ *
+ * The pixel mask of small triangles has a bit for every covered pixel of the bounding box (row by row,
+ * SMALL_TRIANGLE_SIZE bits per row), it is zero for all other triangles. The shade mode is resolved per
+ * instance (never SHADE_MODE_DEFAULT) and selects the raster kernel of the triangle.
+ */
+typedef struct {
+    unsigned int v[3];
+    Bounds bounds;
+    float area;
+    int scanline;
+    unsigned int pixelMask;
+    unsigned int attributeCount;
+    int normalOffset;
+    int texcoordOffset;
+    const Texture* texture;
+    ShadeMode shadeMode;
+} Triangle;
+
+/**
+ * Memory which is kept between frames, it only grows
+ */
+typedef struct {
+    void* data;
+    size_t size;
+} Buffer;
+
+/**
+ * Triangles which passed a single setup job together with their attribute planes
+ *
+ * The storage grows when clipping splits a triangle into several triangles. Clip vertices are created by
+ * clipping and are referenced by the triangles using their index after the transformed vertices of the frame.
+ * The bin and cursors buffers store the bins of the triangles of tiled and streamed draws.
+ */
+typedef struct {
+    Triangle* triangles;
+    float* planes;
+    unsigned int count;
+    unsigned int capacity;
+    size_t planeCapacity;
+    Vector3* clipCamera;
+    Vector3* clipRaster;
+    unsigned int clipCount;
+    unsigned int clipCapacity;
+    Buffer bin;
+    Buffer cursors;
+} SetupBatch;
+
+/**
+ * Buffers of the frames of a draw, kept by a draw context between its draws (see DrawContext)
+ *
+ * Every setup job keeps its batch, the batches of all jobs of the context are kept.
+ */
+typedef struct {
+    Buffer vertexOffsets;
+    Buffer triangleOffsets;
+    Buffer camera;
+    Buffer raster;
+    Buffer varyings;
+    Buffer binOffsets;
+    Buffer bins;
+    Buffer tileColors;
+    Buffer tileDepths;
+    Buffer threadStats;
+    Buffer querySamples;
+    SetupBatch* batches;
+    unsigned int batchCount;
+} FrameStorage;
+
+/**
+ * Vertex of a polygon which is clipped in camera space, the attributes are not divided by depth
+ */
+typedef struct {
+    Vector3 camera;
+    float attributes[MAX_ATTRIBUTES];
+} ClipVertex;
+
+/**
+ * Covered pixel of a triangle row which passed the depth test and still has to be shaded
+ *
+ * The level of detail is only computed for textured triangles. The coverage contains a bit for every
+ * sample of the pixel which is covered and passed the depth test.
+ */
+typedef struct {
+    int x;
+    float z;
+    float a[3];
+    float lod;
+    unsigned int coverage;
+    float attributes[MAX_ATTRIBUTES];
+} Fragment;
+
+/**
+ * Mapping of the reciprocal depth to the unorm depth formats, derived from the depth range of the render target
+ *
+ * The reciprocal depth w is stored as (nearW - w) * scale, from zero at the near up to one at the far distance.
+ * The span is the range of the reciprocal depth, the reciprocal of the scale.
+ */
+typedef struct {
+    float nearW;
+    float span;
+    float scale;
+    float far;
+} DepthRange;
+
+/**
+ * Shadow map of a draw together with the projection it was drawn with, derived once per draw
+ */
+typedef struct {
+    const ShadowMap* map;
+    DepthRange range;
+    float width;
+    float height;
+    float wAspect;
+    float hAspect;
+} ShadowSetup;
+
+/**
+ * State of a single drawInstances call which is shared by all stages
+ *
+ * The vertices of all instances are stored after each other in the camera and raster arrays, followed by
+ * the vertices created by clipping. The triangles of setup job j are stored in batches[j].
+ *
+ * Tiled draw modes bin the triangles of every setup job per tile: the bin of job j and tile t contains the
+ * indices (inside of batches[j]) from binOffsets[j * (tileCount + 1) + t] up to the offset of tile t + 1
+ * inside of bins[j]. Bins are (1 << binShiftX) by (1 << binShiftY) pixels. Every thread owns the local buffers
+ * of a single tile, depth only draws have no tile colors. Streamed draws bin the triangles per strip, which
+ * are tiles as wide as the image.
+ *
+ * Direct and streamed draws split the raster rows into bands, the bands are drawn into the raster surface.
+ * Streamed draws only walk the triangles of the bin of the current strip. Occlusion queries are walked like
+ * direct draws, every thread counts the samples which passed the depth test in its element of querySamples.
+ *
+ * Vertex attributes are stored divided by the vertex depth (multiplied by 1 / w) with a stride of
+ * attributeStride floats per vertex. For each setup triangle the screen space plane equation of every
+ * attribute is stored as three floats: the x and y gradient and the value at the first vertex.
+ *
+ * The clip planes are stored as x, y, z coefficient and offset in camera space, points with a positive
+ * distance are inside. The scissor contains the pixels of the target inside of the scissor rectangle of the
+ * state, all pixels of the target without one.
+ *
+ * All buffers are taken from the storage, which is the storage of the draw context of the draw list or the own
+ * storage of the frame. The stages run on the thread pool of the draw context, without one parallelFor starts
+ * the threads of every stage.
+ */
+typedef struct {
+    const RenderTarget* target;
+    const DrawList* drawList;
+    FrameStorage* storage;
+    FrameStorage ownStorage;
+    ThreadPool* pool;
+    unsigned int* vertexOffsets;
+    unsigned int* triangleOffsets;
+    unsigned int vertexCount;
+    unsigned int triangleCount;
+    unsigned int bandCount;
+    unsigned int threadCount;
+    unsigned int attributeStride;
+    Vector3* camera;
+    Vector3* raster;
+    float* varyings;
+    SetupBatch* batches;
+    float clipPlanes[CLIP_PLANE_COUNT][4];
+    unsigned int tilesX;
+    unsigned int tileCount;
+    unsigned int binShiftX;
+    unsigned int binShiftY;
+    unsigned int* binOffsets;
+    unsigned int** bins;
+    unsigned char* tileColors;
+    unsigned char* tileDepths;
+    RasterStats* threadStats;
+    PipelineState state;
+    Bounds scissor;
+    Bounds rasterRows;
+    Surface rasterSurface;
+    unsigned int strip;
+    unsigned long long* querySamples;
+    DepthRange depthRange;
+    ShadowSetup shadow;
+    float wAspect;
+    float hAspect;
+} Frame;
+
+/**
+ * Grow a buffer to a size, the content is kept
+ *
+ * @param buffer Buffer to grow
+ * @param size Required size in bytes
+ * @return Memory of the buffer
+ */
+static void* reserveBuffer(Buffer* buffer, size_t size) {
+    if (size > buffer->size) {
+        buffer->data = realloc(buffer->data, size);
+        buffer->size = size;
+    }
+    return buffer->data;
+}
+
+/**
+ * Grow the storage of the triangles and attribute planes of a setup job, the content is kept
+ *
+ * @param batch Triangles of the setup job
+ * @param capacity Required count of triangles
+ * @param attributeStride Count of attributes stored per triangle
+ */
+static void reserveTriangles(SetupBatch* batch, unsigned int capacity, unsigned int attributeStride) {
+    if (!batch->triangles || capacity > batch->capacity) {
+        batch->capacity = MAX(batch->capacity, capacity);
+        batch->triangles = realloc(batch->triangles, MAX(1, batch->capacity) * sizeof(Triangle));
+    }
+
+    size_t planes = (size_t)MAX(1, batch->capacity) * attributeStride * 3;
+    if (planes > batch->planeCapacity) {
+        batch->planes = realloc(batch->planes, planes * sizeof(float));
+        batch->planeCapacity = planes;
+    }
+}
+
+/**
+ * Get the tile size of a render target as a shift, linear targets are stored as tiles of a single pixel
+ *
+ * @param target Render target
+ * @return Shift of the tile size
+ */
+static unsigned int tileShift(const RenderTarget* target) {
+    return target->layout == TARGET_LAYOUT_TILED ? TILE_SHIFT : 0;
+}
+
+/**
+ * Get the count of samples per pixel of a render target
+ *
+ * @param target Render target
+ * @return 1, 4 or 8
+ */
+static unsigned int targetSamples(const RenderTarget* target) {
+    return target->sampleCount <= 1 ? 1 : target->sampleCount <= 4 ? 4 : 8;
+}
+
+/**
+ * Get the offset of the first pixel of a row inside of the buffers of a render target
+ *
+ * @param target Render target
+ * @param y Row
+ * @return Offset in elements
+ */
+static size_t rowOffset(const RenderTarget* target, int y) {
+    unsigned int shift = tileShift(target);
+    size_t tilesX = (target->width + (1u << shift) - 1) >> shift;
+    return (((size_t)(y >> shift) * tilesX) << (shift * 2)) + ((size_t)(y & ((1 << shift) - 1)) << shift);
+}
+
+/**
+ * Get the offset of a pixel relative to the first pixel of its row
+ *
+ * @param shift Tile size of the render target as a shift
+ * @param x Column
+ * @return Offset in elements
+ */
+static size_t columnOffset(unsigned int shift, int x) {
+    return ((size_t)(x >> shift) << (shift * 2)) + (size_t)(x & ((1 << shift) - 1));
+}
+
+/**
+ * Get the pixels of a render target inside of a rectangle
+ *
+ * @param target Render target
+ * @param rect Rectangle, NULL for all pixels of the target
+ * @return Pixels inside of both, empty (maximum below minimum) when the rectangle does not overlap the target
+ */
+static Bounds targetBounds(const RenderTarget* target, const Rect* rect) {
+    Bounds bounds = { 0, 0, (int)target->width - 1, (int)target->height - 1 };
+    if (!rect)
+        return bounds;
+
+    bounds.minX = (int)MIN(rect->x, target->width);
+    bounds.minY = (int)MIN(rect->y, target->height);
+    bounds.maxX = (int)MIN((unsigned long long)rect->x + rect->width, target->width) - 1;
+    bounds.maxY = (int)MIN((unsigned long long)rect->y + rect->height, target->height) - 1;
+    return bounds;
+}
+
+/**
+ * Get the depth mapping of a render target
+ *
+ * @param target Render target
+ * @return Depth range of the target
+ */
+static DepthRange targetDepthRange(const RenderTarget* target) {
+    float span = 1.f / target->nearClipping - 1.f / target->farClipping;
+    return (DepthRange) {
+        .nearW = 1.f / target->nearClipping,
+        .span = span,
+        .scale = 1 / span,
+        .far = target->farClipping
+    };
+}
+
+/**
+ * Map a reciprocal depth to a unorm depth value
+ *
+ * @param w Reciprocal view depth
+ * @param max Highest value of the format, which is stored at the far clipping plane
+ * @param range Depth range of the render target
+ * @return Quantized depth
+ */
+static inline unsigned int quantizeDepth(float w, unsigned int max, const DepthRange* range) {
+    // The negated comparison also maps an invalid (NaN) depth to the near clipping plane
+    float d = (range->nearW - w) * range->scale;
+    return !(d > 0) ? 0 : d >= 1 ? max : (unsigned int)(d * (float)max + .5f);
+}
+
+/**
+ * Convert a stored depth value back to view depth
+ *
+ * @param zBuffer zBuffer of the render target
+ * @param depthFormat Element type of the zBuffer
+ * @param offset Offset of the pixel in elements
+ * @param range Depth range of the render target
+ * @return View depth
+ */
+static float loadDepth(const void* zBuffer, DepthFormat depthFormat, size_t offset, const DepthRange* range) {
+    unsigned int max = depthFormat == DEPTH_FORMAT_UNORM16 ? 0xFFFF : 0xFFFFFF;
+    unsigned int d;
+
+    switch (depthFormat) {
+        case DEPTH_FORMAT_UNORM16: d = ((const unsigned short*)zBuffer)[offset]; break;
+        case DEPTH_FORMAT_UNORM24: d = ((const unsigned int*)zBuffer)[offset]; break;
+        default: return ((const float*)zBuffer)[offset];
+    }
+
+    // The cleared value maps exactly to the far clipping plane
+    if (d >= max)
+        return range->far;
+
+    float w = range->nearW - (float)d / (float)max * range->span;
+    return 1 / w;
+}
+
+/**
+ * Depth test a fragment and store its depth when it passes
+ *
+ * @param zBuffer zBuffer of the render target
+ * @param depthFormat Element type of the zBuffer
+ * @param offset Offset of the pixel in elements
+ * @param w Reciprocal view depth of the fragment
+ * @param range Depth range of the render target
+ * @param write Non zero to store the depth of a passing fragment, zero for occlusion queries
+ * @return Non zero when the fragment is closer than the stored depth
+ */
+static FORCE_INLINE int depthTest(void* zBuffer, DepthFormat depthFormat, size_t offset, float w, const DepthRange* range, int write) {
+    switch (depthFormat) {
+        case DEPTH_FORMAT_UNORM16: {
+            unsigned short* depth = (unsigned short*)zBuffer + offset;
+            unsigned short d = (unsigned short)quantizeDepth(w, 0xFFFF, range);
+            if (d >= *depth)
+                return 0;
+
+            if (write)
+                *depth = d;
+            return 1;
+        }
+
+        case DEPTH_FORMAT_UNORM24: {
+            unsigned int* depth = (unsigned int*)zBuffer + offset;
+            unsigned int d = quantizeDepth(w, 0xFFFFFF, range);
+            if (d >= *depth)
+                return 0;
+
+            if (write)
+                *depth = d;
+            return 1;
+        }
+
+        default: {
+            float* depth = (float*)zBuffer + offset;
+            float z = 1 / w;
+            if (z >= *depth)
+                return 0;
+
+            if (write)
+                *depth = z;
+            return 1;
+        }
+    }
+}
+
+/**
+ * Clear depth values to the far clipping plane
+ *
+ * @param zBuffer Depth values to clear
+ * @param depthFormat Element type of the depth values
+ * @param count Count of depth values
+ * @param far Far clipping distance, the value of the cleared float depths
+ */
+static void clearDepth(void* zBuffer, DepthFormat depthFormat, size_t count, float far) {
+    switch (depthFormat) {
+        case DEPTH_FORMAT_UNORM16:
+            for (size_t i = 0; i < count; ++i) { ((unsigned short*)zBuffer)[i] = 0xFFFF; }
+            break;
+
+        case DEPTH_FORMAT_UNORM24:
+            for (size_t i = 0; i < count; ++i) { ((unsigned int*)zBuffer)[i] = 0xFFFFFF; }
+            break;
+
+        default:
+            for (size_t i = 0; i < count; ++i) { ((float*)zBuffer)[i] = far; }
+            break;
+    }
+}
+
+void viewAspect(float deviceAspect, unsigned int width, unsigned int height, float* wAspect, float* hAspect) {
+    float frameAspect = (float)width / (float)height;
+
+    *wAspect = 1;
+    *hAspect = 1;
+
+    if (deviceAspect > frameAspect) {
+        *hAspect *= frameAspect / deviceAspect;
+    }
+    else {
+        *wAspect *= deviceAspect / frameAspect;
+    }
+}
+
+Vector3 cameraToRaster(const Vector3* v, float width, float height, float wAspect, float hAspect, float near) {
+#if FAST_MATH
+    float w = rcpFast(-v->z);
+    return (Vector3) {
+        .x = (1 + near * (v->x * wAspect) * w) * 0.5f * width,
+        .y = (1 - near * (v->y * hAspect) * w) * 0.5f * height,
+        .z = w
+    };
+#else
+    return (Vector3) {
+        .x = (1 + near * (v->x * wAspect) / -v->z) * 0.5f * width,
+        .y = (1 - near * (v->y * hAspect) / -v->z) * 0.5f * height,
+        .z = 1 / -v->z
+    };
+#endif
+}
+
+/**
+ * Map camera space vertices stored as separate x, y and z arrays to raster space, SIMD_WIDTH vertices at a time
+ *
+ * Every vertex is computed using the same operations as cameraToRaster, the results are identical to mapping
+ * the vertices one by one.
+ *
+ * @param x X components of the camera vertices
+ * @param y Y components of the camera vertices
+ * @param z Z components of the camera vertices
+ * @param count Count of vertices
+ * @param width Width in pixels of the screen
+ * @param height Height in pixels of the screen
+ * @param wAspect Corrected scale x, see viewAspect
+ * @param hAspect Corrected scale y, see viewAspect
+ * @param near Near clipping distance
+ * @param out Destination of the raster vertices
+ */
+static void cameraToRasterBatch(const float* x, const float* y, const float* z, unsigned int count, float width, float height,
+        float wAspect, float hAspect, float near, Vector3* out) {
+    FloatN one = floatNSet(1);
+    FloatN minusOne = floatNSet(-1);
+    FloatN half = floatNSet(0.5f);
+    FloatN nearN = floatNSet(near);
+    unsigned int i = 0;
+
+    for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+        float rx[SIMD_WIDTH], ry[SIMD_WIDTH], rz[SIMD_WIDTH];
+        FloatN depth = floatNMul(minusOne, floatNLoad(z + i));
+        FloatN px = floatNMul(nearN, floatNMul(floatNLoad(x + i), floatNSet(wAspect)));
+        FloatN py = floatNMul(nearN, floatNMul(floatNLoad(y + i), floatNSet(hAspect)));
+
+#if FAST_MATH
+        FloatN w = floatNRcp(depth);
+        px = floatNMul(px, w);
+        py = floatNMul(py, w);
+#else
+        FloatN w = floatNDiv(one, depth);
+        px = floatNDiv(px, depth);
+        py = floatNDiv(py, depth);
+#endif
+
+        floatNStore(rx, floatNMul(floatNMul(floatNAdd(one, px), half), floatNSet(width)));
+        floatNStore(ry, floatNMul(floatNMul(floatNSub(one, py), half), floatNSet(height)));
+        floatNStore(rz, w);
+
+        for (int k = 0; k < SIMD_WIDTH; ++k) {
+            out[i + k] = (Vector3) { rx[k], ry[k], rz[k] };
+        }
+    }
+
+    for (; i < count; ++i) {
+        Vector3 v = { x[i], y[i], z[i] };
+        out[i] = cameraToRaster(&v, width, height, wAspect, hAspect, near);
+    }
+}
+
+/**
+ * Evaluate a screen space plane equation at a pixel
+ *
+ * @param plane Plane as x gradient, y gradient and value at the origin
+ * @param origin Raster position of the first vertex of the triangle
+ * @param x Pixel x coordinate
+ * @param y Pixel y coordinate
+ * @return Value of the plane
+ */
+static float planeAt(const float plane[3], const Vector3* origin, float x, float y) {
+    return plane[2] + plane[0] * (x - origin->x) + plane[1] * (y - origin->y);
+}
+
+/**
+ * Pack a gray value into a RGBA pixel, independent of the byte order of the platform
+ *
+ * @param value Gray value
+ * @return Packed pixel
+ */
+static unsigned int packGray(unsigned char value) {
+    unsigned char rgba[4] = { value, value, value, 255 };
+    unsigned int pixel;
+    memcpy(&pixel, rgba, sizeof(pixel));
+    return pixel;
+}
+
+/**
+ * Per triangle constants of the shading, computed once instead of for every pixel
+ *
+ * The projected vertices are the camera space x and y divided by the depth of each vertex. The face normal
+ * is the normalized normal of the triangle in camera space, used when the mesh has no vertex normals. Flat
+ * shaded triangles store their shade and color, Gouraud shaded triangles the shade of every vertex multiplied
+ * by its reciprocal depth, which makes the shade linear in screen space. The shadow is NULL when the triangle
+ * does not receive shadows, the projected vertices are then only computed for per pixel lighting.
+ */
+typedef struct {
+    float projected[3][2];
+    Vector3 faceNormal;
+    unsigned char flatShade;
+    unsigned int flatColor;
+    float vertexShades[3];
+    const ShadowSetup* shadow;
+} ShadeSetup;
+
+/**
+ * Light a point in camera space, the light is located at the camera
+ *
+ * @param normal Normal at the point, not necessarily normalized
+ * @param view Direction from the point towards the camera, not necessarily normalized
+ * @return Shade in the range of 0 to 1
+ */
+static float lightPoint(const Vector3* normal, const Vector3* view) {
+    Vector3 n = normalizeVec3(normal);
+    Vector3 v = normalizeVec3(view);
+    return MAX(0, dotVec3(&n, &v));
+}
+
+/**
+ * Look up how much light from the light of a shadow map reaches a point
+ *
+ * The point is moved to the camera space of the light and projected onto the shadow map, which compares its
+ * depth to the nearest depth of the shadow map (or to the (2 * radius + 1)^2 nearest depths when filtered).
+ *
+ * @param shadow Shadow map of the draw
+ * @param px Camera space x divided by depth of the point
+ * @param py Camera space y divided by depth of the point
+ * @param z View depth of the point
+ * @return Factor of the shade, 1 when lit and 1 - strength in full shadow
+ */
+static float shadowLight(const ShadowSetup* shadow, float px, float py, float z) {
+    const ShadowMap* map = shadow->map;
+    const RenderTarget* target = map->target;
+    Vector3 camera = { px * z, py * z, -z };
+    Vector3 light = transformVec3(&camera, &map->cameraToLight);
+
+    // Points in front of the near plane of the light are not covered by the shadow map
+    if (!(light.z < -target->nearClipping))
+        return 1;
+
+    Vector3 r = cameraToRaster(&light, shadow->width, shadow->height, shadow->wAspect, shadow->hAspect, target->nearClipping);
+    int radius = (int)map->filterRadius;
+    if (!(r.x > -(float)radius - 1 && r.x < shadow->width + (float)radius && r.y > -(float)radius - 1 && r.y < shadow->height + (float)radius))
+        return 1;
+
+    // Pixels of the shadow map are located at integer coordinates, the nearest pixel is the center of the filter
+    int centerX = (int)floorf(r.x + .5f);
+    int centerY = (int)floorf(r.y + .5f);
+    float depth = -light.z - map->bias;
+    unsigned int shift = tileShift(target);
+    unsigned int samples = targetSamples(target);
+    int shadowed = 0;
+
+    for (int y = centerY - radius; y <= centerY + radius; ++y) {
+        if (y < 0 || y >= (int)target->height)
+            continue;
+
+        size_t row = rowOffset(target, y);
+        for (int x = centerX - radius; x <= centerX + radius; ++x) {
+            if (x >= 0 && x < (int)target->width)
+                shadowed += depth > loadDepth(target->zBuffer, target->depthFormat, (row + columnOffset(shift, x)) * samples, &shadow->range);
+        }
+    }
+
+    int taps = (2 * radius + 1) * (2 * radius + 1);
+    return 1 - map->strength * (float)shadowed / (float)taps;
+}
+
+/**
+ * Compute the shading constants of a triangle
+ *
+ * @param mode Shade mode of the triangle
+ * @param triangle Triangle to shade
+ * @param c Triangle in camera space
+ * @param r Triangle in raster space
+ * @param planes Attribute planes of the triangle
+ * @param backgroundColor Background color of the framebuffer
+ * @param shadow Shadow map of the draw, NULL when the triangle does not receive shadows
+ * @param setup Constants to fill
+ */
+static FORCE_INLINE void setupShade(ShadeMode mode, const Triangle* triangle, const Vector3 c[3], const Vector3 r[3], const float* planes, unsigned char backgroundColor,
+                                    const ShadowSetup* shadow, ShadeSetup* setup) {
+    setup->shadow = shadow;
+
+    int faceNormal = mode == SHADE_MODE_FLAT || triangle->normalOffset < 0;
+    if (faceNormal) {
+        Vector3 line1 = subVec3(&c[1], &c[0]);
+        Vector3 line2 = subVec3(&c[2], &c[0]);
+        Vector3 cross = crossVec3(&line1, &line2);
+
+        setup->faceNormal = normalizeVec3(&cross);
+    }
+
+    switch (mode) {
+        case SHADE_MODE_FLAT: {
+            Vector3 view = { -(c[0].x + c[1].x + c[2].x) / 3, -(c[0].y + c[1].y + c[2].y) / 3, -(c[0].z + c[1].z + c[2].z) / 3 };
+            setup->flatShade = (unsigned char)(lightPoint(&setup->faceNormal, &view) * 255);
+            setup->flatColor = packGray(abs(backgroundColor - setup->flatShade));
+            break;
+        }
+
+        case SHADE_MODE_GOURAUD:
+            for (int i = 0; i < 3; ++i) {
+                Vector3 normal = setup->faceNormal;
+
+                // Vertex normals are restored from the planes of the normal, which also covers vertices created by clipping
+                if (!faceNormal) {
+                    const float* plane = planes + triangle->normalOffset * 3;
+                    float z = 1 / r[i].z;
+                    normal.x = planeAt(plane, &r[0], r[i].x, r[i].y) * z;
+                    normal.y = planeAt(plane + 3, &r[0], r[i].x, r[i].y) * z;
+                    normal.z = planeAt(plane + 6, &r[0], r[i].x, r[i].y) * z;
+                }
+
+                Vector3 view = { -c[i].x, -c[i].y, -c[i].z };
+                setup->vertexShades[i] = lightPoint(&normal, &view) * 255 * r[i].z;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    // Per pixel lighting and shadows need the position of every pixel
+    if (mode == SHADE_MODE_PIXEL || mode == SHADE_MODE_TEXTURED || shadow) {
+        for (int i = 0; i < 3; ++i) {
+            setup->projected[i][0] = c[i].x / -c[i].z;
+            setup->projected[i][1] = c[i].y / -c[i].z;
+        }
+    }
+}
+
+/**
+ * This functions calculates the shade value of a point based on the angle of the triangle in relation to the camera
+ * (using the cross product) and uses bary centric coordinates to get an interpolated color inside the triangle its self.
+ *
+ * @param z Barycentric z component of the pixel
+ * @param setup Shading constants of the triangle
+ * @param a Barycentric area of each triangle point
+ * @param normal Interpolated normal in camera space, NULL to use the normal of the triangle
+ * @return Returns a char which represents the shaded value.
+ */
+static unsigned char getPixelShade(float z, const ShadeSetup* setup, const float a[3], const float* normal) {
+    /*
+     * Interpolate correct shade value distribution using barycentric coordinate system.
+     * Later this value will be used as scalar value together with the actual triangle shade color.
+     */
+    float px = setup->projected[0][0] * a[0] + setup->projected[1][0] * a[1] + setup->projected[2][0] * a[2];
+    float py = setup->projected[0][1] * a[0] + setup->projected[1][1] * a[1] + setup->projected[2][1] * a[2];
+
+    Vector3 viewDirection = {px * -z, py * -z, z };
+    Vector3 nViewDirection = normalizeVec3(&viewDirection);
+
+    Vector3 nCamera = setup->faceNormal;
+    if (normal) {
+        Vector3 interpolated = { normal[0], normal[1], normal[2] };
+        nCamera = normalizeVec3(&interpolated);
+    }
+
+    return (unsigned char)(MAX(0, dotVec3(&nCamera, &nViewDirection)) * 255);
+}
+
+/**
+ * Write a span of packed RGBA pixels, only pixels with a set mask are written
+ *
+ * Pixels are blended with the current content of the frameBuffer per SIMD register, which
+ * allows 4 (SSE2 / NEON) or 8 (AVX2) pixels to be written using a single store.
+ *
+ * @param dst Pointer to the first pixel of the span inside of the frameBuffer
+ * @param colors Packed pixels of the span
+ * @param masks Mask of each pixel of the span, either all bits or no bits set
+ * @param count Count of pixels in the span
+ */
+static void writeRgbaSpan(unsigned int* dst, const unsigned int* colors, const unsigned int* masks, int count) {
+    int i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 8 <= count; i += 8) {
+        __m256i mask = _mm256_loadu_si256((const __m256i*)(masks + i));
+        _mm256_maskstore_epi32((int*)(dst + i), mask, _mm256_loadu_si256((const __m256i*)(colors + i)));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (; i + 4 <= count; i += 4) {
+        __m128i mask = _mm_loadu_si128((const __m128i*)(masks + i));
+        __m128i color = _mm_loadu_si128((const __m128i*)(colors + i));
+        __m128i current = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(mask, color), _mm_andnot_si128(mask, current)));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= count; i += 4) {
+        vst1q_u32(dst + i, vbslq_u32(vld1q_u32(masks + i), vld1q_u32(colors + i), vld1q_u32(dst + i)));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        if (masks[i])
+            dst[i] = colors[i];
+    }
+}
+
+/**
+ * Convert a packed pixel to gray using integer luminance, the weights sum up to 256 which keeps gray pixels unchanged
+ *
+ * @param color Packed pixel
+ * @return Gray value
+ */
+static unsigned char luminance(unsigned int color) {
+    unsigned char rgba[4];
+    memcpy(rgba, &color, sizeof(color));
+    return (unsigned char)((rgba[0] * 77 + rgba[1] * 150 + rgba[2] * 29) >> 8);
+}
+
+/**
+ * Compute the packed RGBA color of a fragment
+ *
+ * Untextured fragments store the shade (relative to the background color) in every channel, textured
+ * fragments store the texture color multiplied by the shade.
+ *
+ * @param mode Shade mode of the triangle, not SHADE_MODE_DEPTH_ONLY
+ * @param shadowed Whether the triangle receives shadows, the shadow of the shading constants is set
+ * @param triangle Triangle the fragment belongs to
+ * @param setup Shading constants of the triangle
+ * @param fragment Fragment to shade
+ * @param backgroundColor Background color of the framebuffer
+ * @return Packed pixel
+ */
+static FORCE_INLINE unsigned int shadeFragment(ShadeMode mode, int shadowed, const Triangle* triangle, const ShadeSetup* setup, const Fragment* fragment, unsigned char backgroundColor) {
+    if (mode == SHADE_MODE_FLAT && !shadowed)
+        return setup->flatColor;
+
+    float light = 1;
+    if (shadowed) {
+        const float* a = fragment->a;
+        float px = setup->projected[0][0] * a[0] + setup->projected[1][0] * a[1] + setup->projected[2][0] * a[2];
+        float py = setup->projected[0][1] * a[0] + setup->projected[1][1] * a[1] + setup->projected[2][1] * a[2];
+        light = shadowLight(setup->shadow, px, py, fragment->z);
+    }
+
+    unsigned char shade;
+    if (mode == SHADE_MODE_FLAT) {
+        shade = (unsigned char)(setup->flatShade * light);
+    }
+    else if (mode == SHADE_MODE_GOURAUD) {
+        // Multiplying by the depth restores the perspective correct shade, pixels of multisampled edges can be outside of the triangle
+        const float* a = fragment->a;
+        float gouraud = (setup->vertexShades[0] * a[0] + setup->vertexShades[1] * a[1] + setup->vertexShades[2] * a[2]) * fragment->z;
+        shade = (unsigned char)(MIN(255, MAX(0, gouraud)) * light);
+    }
+    else {
+        const float* normal = triangle->normalOffset < 0 ? NULL : fragment->attributes + triangle->normalOffset;
+        shade = getPixelShade(fragment->z, setup, fragment->a, normal);
+        if (shadowed)
+            shade = (unsigned char)(shade * light);
+    }
+
+    if (mode != SHADE_MODE_TEXTURED)
+        return packGray(abs(backgroundColor - shade));
+
+    const float* texcoord = fragment->attributes + triangle->texcoordOffset;
+    unsigned int texel = sampleTexture(triangle->texture, texcoord[0], texcoord[1], fragment->lod);
+
+    unsigned char rgba[4];
+    memcpy(rgba, &texel, sizeof(texel));
+    for (int k = 0; k < 3; ++k) { rgba[k] = (unsigned char)(rgba[k] * shade / 255); }
+    memcpy(&texel, rgba, sizeof(texel));
+    return texel;
+}
+
+/**
+ * Shade a span of fragments of a single row and write them into the frameBuffer
+ *
+ * All fragments of the span are within FRAGMENT_BATCH pixels of the first fragment.
+ *
+ * @param mode Shade mode of the triangle, not SHADE_MODE_DEPTH_ONLY
+ * @param multisampled Whether the render target stores multiple samples per pixel
+ * @param shadowed Whether the triangle receives shadows
+ * @param triangle Triangle the fragments belong to
+ * @param setup Shading constants of the triangle
+ * @param fragments Fragments to shade, ordered from left to right
+ * @param count Count of fragments
+ * @param surface Buffers to draw into
+ * @param y Row of the fragments
+ * @param shadeMap Pointer to the first counter of the row inside of the shade heatmap, NULL when disabled
+ */
+static FORCE_INLINE void shadeFragments(ShadeMode mode, int multisampled, int shadowed, const Triangle* triangle, const ShadeSetup* setup, const Fragment* fragments, int count, const Surface* surface, int y, unsigned int* shadeMap) {
+    const RenderTarget* target = surface->target;
+    unsigned char backgroundColor = target->backgroundColor;
+    unsigned int pixelSize = colorFormatSize(target->colorFormat);
+    unsigned int samples = multisampled ? targetSamples(target) : 1;
+    unsigned char* row = target->frameBuffer + rowOffset(target, y - surface->originY) * samples * pixelSize;
+    unsigned int shift = tileShift(target);
+    int originX = surface->originX;
+
+    // Every pixel is shaded once, the color is stored in each sample of its coverage
+    if (multisampled) {
+        for (int i = 0; i < count; ++i) {
+            unsigned int color = shadeFragment(mode, shadowed, triangle, setup, &fragments[i], backgroundColor);
+            unsigned char gray = luminance(color);
+            unsigned char* pixel = row + columnOffset(shift, fragments[i].x - originX) * samples * pixelSize;
+
+            for (unsigned int s = 0; s < samples; ++s) {
+                if (fragments[i].coverage & (1u << s)) {
+                    if (target->colorFormat == COLOR_FORMAT_GRAY8)
+                        pixel[s] = gray;
+                    else
+                        memcpy(pixel + s * pixelSize, &color, pixelSize);
+                }
+            }
+        }
+    }
+    else switch (target->colorFormat) {
+        case COLOR_FORMAT_GRAY8:
+            for (int i = 0; i < count; ++i) {
+                row[columnOffset(shift, fragments[i].x - originX)] = luminance(shadeFragment(mode, shadowed, triangle, setup, &fragments[i], backgroundColor));
+            }
+            break;
+
+        case COLOR_FORMAT_RGB8:
+            for (int i = 0; i < count; ++i) {
+                unsigned int color = shadeFragment(mode, shadowed, triangle, setup, &fragments[i], backgroundColor);
+                memcpy(row + columnOffset(shift, fragments[i].x - originX) * 3, &color, 3);
+            }
+            break;
+
+        case COLOR_FORMAT_RGBA8: {
+            unsigned int colors[FRAGMENT_BATCH];
+            unsigned int masks[FRAGMENT_BATCH];
+
+            int spanX = fragments[0].x - originX;
+            int spanWidth = fragments[count - 1].x - fragments[0].x + 1;
+            memset(masks, 0, spanWidth * sizeof(unsigned int));
+
+            for (int i = 0; i < count; ++i) {
+                int offset = fragments[i].x - fragments[0].x;
+                colors[offset] = shadeFragment(mode, shadowed, triangle, setup, &fragments[i], backgroundColor);
+                masks[offset] = ~0u;
+            }
+
+            // The span is only contiguous in memory within a tile
+            for (int start = 0; start < spanWidth;) {
+                int x = spanX + start;
+                int end = MIN(spanWidth, (((x >> shift) + 1) << shift) - spanX);
+                writeRgbaSpan((unsigned int*)row + columnOffset(shift, x), colors + start, masks + start, end - start);
+                start = end;
+            }
+            break;
+        }
+
+        // Depth only targets are never shaded
+        case COLOR_FORMAT_NONE:
+            break;
+    }
+
+    if (shadeMap) {
+        for (int i = 0; i < count; ++i) { shadeMap[fragments[i].x]++; }
+    }
+}
+
+/**
+ * Shade a span of fragments, see shadeFragments, the shading with and without shadows is selected per span
+ */
+static FORCE_INLINE void shadeBatch(ShadeMode mode, int multisampled, const Triangle* triangle, const ShadeSetup* setup, const Fragment* fragments, int count, const Surface* surface, int y, unsigned int* shadeMap) {
+    if (setup->shadow)
+        shadeFragments(mode, multisampled, 1, triangle, setup, fragments, count, surface, y, shadeMap);
+    else
+        shadeFragments(mode, multisampled, 0, triangle, setup, fragments, count, surface, y, shadeMap);
+}
+
+/**
+ * Compute the texture level of detail of the 2x2 pixel quad which contains a pixel
+ *
+ * Like on a GPU the texture coordinate is evaluated at the top left, top right and bottom left pixel of the
+ * quad and their differences are used as screen space derivatives. All pixels of a quad share the same level,
+ * also when the triangle only covers a part of the quad.
+ *
+ * @param triangle Textured triangle
+ * @param planes Attribute planes of the triangle
+ * @param depthPlane Plane of the reciprocal depth of the triangle
+ * @param origin Raster position of the first vertex of the triangle
+ * @param x Pixel x coordinate
+ * @param y Pixel y coordinate
+ * @return Level of detail
+ */
+static float quadLod(const Triangle* triangle, const float* planes, const float depthPlane[3], const Vector3* origin, int x, int y) {
+    const float* uPlane = planes + triangle->texcoordOffset * 3;
+    const float* vPlane = uPlane + 3;
+
+    float qx = (float)(x & ~1);
+    float qy = (float)(y & ~1);
+    float px[3] = { qx, qx + 1, qx };
+    float py[3] = { qy, qy, qy + 1 };
+    float u[3], v[3];
+
+    for (int i = 0; i < 3; ++i) {
+        float z = 1 / planeAt(depthPlane, origin, px[i], py[i]);
+        u[i] = planeAt(uPlane, origin, px[i], py[i]) * z;
+        v[i] = planeAt(vPlane, origin, px[i], py[i]) * z;
+    }
+
+    return textureLod(triangle->texture, u[1] - u[0], v[1] - v[0], u[2] - u[0], v[2] - v[0]);
+}
+
+/**
+ * Test if a sample is on the inner side of an edge using the top left fill rule
+ *
+ * Samples exactly on an edge only belong to the triangle when it is a left edge (the edge function grows in x)
+ * or a horizontal top edge (it grows in y), a sample on an edge shared by two triangles is covered once.
+ *
+ * @param e Edge function at the sample
+ * @param edgeX Gradient of the edge function in x
+ * @param edgeY Gradient of the edge function in y
+ * @return Non zero when the sample is inside
+ */
+static inline int insideEdge(float e, float edgeX, float edgeY) {
+    return e > 0 || (e == 0 && (edgeX > 0 || (edgeX == 0 && edgeY > 0)));
+}
+
+/**
+ * Test which samples of a pixel are covered by a triangle
+ *
+ * A pixel is covered when it falls inside of the triangle using the edge function based on the clockwise
+ * winding (CW) order, see insideEdge. The edge functions are linear, their value at a sample is stepped from
+ * the pixel position.
+ *
+ * @param a Edge functions at the pixel position (the area of each triangle point)
+ * @param edgeX Gradients of the edge functions in x, in the order of the barycentric weights
+ * @param edgeY Gradients of the edge functions in y, in the order of the barycentric weights
+ * @param samples Count of samples per pixel
+ * @return Mask with a bit for every covered sample, zero when the pixel is not covered
+ */
+static inline unsigned int sampleCoverage(const float a[3], const float edgeX[3], const float edgeY[3], unsigned int samples) {
+    if (samples == 1)
+        return insideEdge(a[0], edgeX[0], edgeY[0]) && insideEdge(a[1], edgeX[1], edgeY[1]) && insideEdge(a[2], edgeX[2], edgeY[2]);
+
+    const float (*samplePositions)[2] = samples == 8 ? SAMPLE_POSITIONS_8 : SAMPLE_POSITIONS_4;
+    unsigned int coverage = 0;
+    for (unsigned int s = 0; s < samples; ++s) {
+        float sx = samplePositions[s][0];
+        float sy = samplePositions[s][1];
+        if (insideEdge(a[0] + edgeX[0] * sx + edgeY[0] * sy, edgeX[0], edgeY[0]) &&
+            insideEdge(a[1] + edgeX[1] * sx + edgeY[1] * sy, edgeX[1], edgeY[1]) &&
+            insideEdge(a[2] + edgeX[2] * sx + edgeY[2] * sy, edgeX[2], edgeY[2]))
+            coverage |= 1u << s;
+    }
+    return coverage;
+}
+
+/**
+ * Test which samples of a pixel are covered by a triangle, see sampleCoverage
+ *
+ * @param r Triangle in raster space
+ * @param edgeX Gradients of the edge functions in x, in the order of the barycentric weights
+ * @param edgeY Gradients of the edge functions in y, in the order of the barycentric weights
+ * @param samples Count of samples per pixel
+ * @param x Pixel x coordinate
+ * @param y Pixel y coordinate
+ * @param a Destination of the edge functions at the pixel position
+ * @return Mask with a bit for every covered sample, zero when the pixel is not covered
+ */
+static inline unsigned int pixelCoverage(const Vector3 r[3], const float edgeX[3], const float edgeY[3], unsigned int samples, int x, int y, float a[3]) {
+    Vector3 p = { (float)x, (float)y, 0 };
+
+    a[0] = edgeFunction(&r[1], &r[2], &p);
+    a[1] = edgeFunction(&r[2], &r[0], &p);
+    a[2] = edgeFunction(&r[0], &r[1], &p);
+
+    return sampleCoverage(a, edgeX, edgeY, samples);
+}
+
+/**
+ * Limit the pixels of a row to the span which can be covered by a triangle
+ *
+ * Along a row every edge function is linear in x, the pixels on the inner side of all three edges form a single
+ * span. The margin grows the triangle by the distance of the samples to the pixel position. The span is widened
+ * by a pixel on both sides to absorb rounding, its pixels are still tested using the edge functions which keeps
+ * the coverage identical to the bounding box traversal.
+ *
+ * @param r Triangle in raster space
+ * @param edgeX Gradients of the edge functions in x, in the order of the barycentric weights
+ * @param edgeY Gradients of the edge functions in y, in the order of the barycentric weights
+ * @param margin Distance of the samples to the pixel position
+ * @param y Row
+ * @param minX First pixel of the row, updated to the first pixel of the span
+ * @param maxX Last pixel of the row, updated to the last pixel of the span
+ * @return Zero when no pixel of the row can be covered
+ */
+static int rowSpan(const Vector3 r[3], const float edgeX[3], const float edgeY[3], float margin, int y, int* minX, int* maxX) {
+    // Edge i starts at the vertex following vertex i
+    const Vector3* origins[3] = { &r[1], &r[2], &r[0] };
+    float lower = (float)*minX - 2;
+    float upper = (float)*maxX + 2;
+
+    for (int i = 0; i < 3; ++i) {
+        float k = edgeY[i] * ((float)y - origins[i]->y) + margin * (fabsf(edgeX[i]) + fabsf(edgeY[i]));
+
+        // Comparisons which are false for NaN leave the span unchanged
+        if (edgeX[i] > 0) {
+            float bound = origins[i]->x - k / edgeX[i];
+            if (bound > lower)
+                lower = bound;
+        }
+        else if (edgeX[i] < 0) {
+            float bound = origins[i]->x - k / edgeX[i];
+            if (bound < upper)
+                upper = bound;
+        }
+        else if (k < 0) {
+            return 0;
+        }
+    }
+
+    if (!(lower <= upper + 2))
+        return 0;
+
+    *minX = MAX(*minX, (int)ceilf(MIN(lower, (float)*maxX + 2)) - 1);
+    *maxX = MIN(*maxX, (int)floorf(MAX(upper, (float)*minX - 2)) + 1);
+    return *minX <= *maxX;
+}
+
+/**
+ * Count the set bits of a sample mask
+ *
+ * @param mask Mask with a bit for every sample
+ * @return Count of samples in the mask
+ */
+static inline unsigned int sampleCount(unsigned int mask) {
+    unsigned int count = 0;
+    for (; mask; mask &= mask - 1) { count++; }
+    return count;
+}
+
+/**
+ * Rasterize a single triangle and draw into the frameBuffer
+ *
+ * The pixels are either traversed using the full bounding box or per scanline, limited to the span of each
+ * row which can be covered by the triangle (see rowSpan). Small triangles only visit the rows and spans of
+ * the pixels which setup found to be covered. Covered pixels which pass the depth test are
+ * collected per row and shaded in batches, which allows the shading to be timed separately when statistics
+ * are requested.
+ *
+ * The function is a template of the raster kernels: it is inlined with constant shade mode, multisampling and
+ * depth format, which removes all branches on them from the pixel loop (see RASTER_KERNEL). Occlusion queries
+ * (see QUERY_KERNEL) only test the depth of the samples without storing it.
+ *
+ * @param frame Frame which stores the transformed vertices
+ * @param batch Triangles of the setup job the triangle belongs to
+ * @param index Index of the triangle inside of the batch
+ * @param surface Buffers to draw into, the clip rectangle must be inside of them
+ * @param clip Pixel rectangle to which drawing is limited
+ * @param stats Statistics to update, NULL when no statistics are requested
+ * @param mode Shade mode of the triangle
+ * @param multisampled Whether the render target stores multiple samples per pixel
+ * @param depthFormat Depth format of the render target
+ * @param query Non zero for an occlusion query, the triangle must be depth only
+ * @return Count of samples which passed the depth test, only counted by occlusion queries
+ */
+static FORCE_INLINE unsigned long long rasterizeTriangle(const Frame* frame, const SetupBatch* batch, unsigned int index, const Surface* surface, const Bounds* clip, RasterStats* stats,
+                                                         ShadeMode mode, int multisampled, DepthFormat depthFormat, int query) {
+    const Triangle* triangle = &batch->triangles[index];
+    const RenderTarget* target = surface->target;
+    unsigned int width = frame->target->width;
+    unsigned int shift = tileShift(target);
+    const DepthRange* depthRange = &frame->depthRange;
+    const ShadowSetup* shadow = frame->shadow.map ? &frame->shadow : NULL;
+
+    Vector3 c[3] = { frame->camera[triangle->v[0]], frame->camera[triangle->v[1]], frame->camera[triangle->v[2]] };
+    Vector3 r[3] = { frame->raster[triangle->v[0]], frame->raster[triangle->v[1]], frame->raster[triangle->v[2]] };
+
+    // Limit the triangle bounding box to the clip rectangle
+    int minY = MAX(clip->minY, triangle->bounds.minY);
+    int maxY = MIN(clip->maxY, triangle->bounds.maxY);
+    int minX = MAX(clip->minX, triangle->bounds.minX);
+    int maxX = MIN(clip->maxX, triangle->bounds.maxX);
+
+    if (minX > maxX || minY > maxY)
+        return 0;
+
+    // Total area of triangle
+    float area = triangle->area;
+
+    // Heatmaps are only available when statistics are requested
+    unsigned int* touchMap = stats ? stats->touchMap : NULL;
+    unsigned int* depthMap = stats ? stats->depthMap : NULL;
+    unsigned int* shadeMap = stats ? stats->shadeMap : NULL;
+
+    /*
+     * Attributes divided by depth are linear in screen space. Their planes are stepped to every row once and only
+     * stepped to the pixels which pass the depth test. Both steps start at the column of the first vertex instead
+     * of the clip rectangle, which makes the bands and tiles of all draw modes produce identical pixels.
+     */
+    unsigned int attributeCount = triangle->attributeCount;
+    const float* planes = batch->planes + (size_t)index * frame->attributeStride * 3;
+    int interpolated = mode == SHADE_MODE_PIXEL || mode == SHADE_MODE_TEXTURED;
+    int planeX = (int)floorf(r[0].x);
+
+    // Gradients of the edge functions, in the order of the barycentric weights
+    float edgeX[3] = { r[2].y - r[1].y, r[0].y - r[2].y, r[1].y - r[0].y };
+    float edgeY[3] = { r[1].x - r[2].x, r[2].x - r[0].x, r[0].x - r[1].x };
+
+    /*
+     * The reciprocal depth is linear in screen space as well, it restores the texture coordinates of a quad
+     * and the depth of the samples of a pixel
+     */
+    unsigned int samples = multisampled ? targetSamples(target) : 1;
+    const float (*samplePositions)[2] = samples == 8 ? SAMPLE_POSITIONS_8 : SAMPLE_POSITIONS_4;
+    float depthPlane[3] = { 0 };
+    ShadeSetup shade = { 0 };
+    if (mode == SHADE_MODE_TEXTURED || multisampled) {
+        depthPlane[0] = (r[0].z * edgeX[0] + r[1].z * edgeX[1] + r[2].z * edgeX[2]) / area;
+        depthPlane[1] = (r[0].z * edgeY[0] + r[1].z * edgeY[1] + r[2].z * edgeY[2]) / area;
+        depthPlane[2] = r[0].z;
+    }
+
+    // Samples are up to half a pixel away from the pixel position
+    float margin = multisampled ? .5f : 0;
+
+    Fragment fragments[FRAGMENT_BATCH];
+    unsigned long long tested = 0;
+    unsigned long long inside = 0;
+    unsigned long long passed = 0;
+    unsigned long long visible = 0;
+    double shadeTime = 0;
+
+    for (int y = minY; y <= maxY; ++y) {
+        unsigned int* shadeRow = shadeMap ? shadeMap + y * width : NULL;
+        size_t zRow = rowOffset(target, y - surface->originY);
+        int count = 0;
+        int quadX = -1;
+        float lod = 0;
+
+        int spanMinX = minX;
+        int spanMaxX = maxX;
+        if (triangle->scanline && !rowSpan(r, edgeX, edgeY, margin, y, &spanMinX, &spanMaxX))
+            continue;
+
+        float rowAttributes[MAX_ATTRIBUTES];
+        if (interpolated) {
+            for (unsigned int k = 0; k < attributeCount; ++k) { rowAttributes[k] = planeAt(planes + k * 3, &r[0], (float)planeX, (float)y); }
+        }
+
+        // Small triangles only visit the pixels of the row which are set in their pixel mask
+        unsigned int rowMask = ~0u;
+        if (triangle->pixelMask) {
+            rowMask = (triangle->pixelMask >> ((y - triangle->bounds.minY) * SMALL_TRIANGLE_SIZE)) & ((1u << SMALL_TRIANGLE_SIZE) - 1);
+            if (rowMask == 0)
+                continue;
+        }
+        else {
+            tested += (unsigned long long)(spanMaxX - spanMinX + 1);
+        }
+
+        // The edge functions of the row are evaluated in chunks of pixels, SIMD_WIDTH pixels at a time
+        float edges[3][FRAGMENT_BATCH];
+        int chunkX = spanMinX;
+        int chunkEnd = spanMinX;
+
+        for (int x = spanMinX; x <= spanMaxX; ++x) {
+            if (triangle->pixelMask) {
+                if (!((rowMask >> (x - triangle->bounds.minX)) & 1))
+                    continue;
+                tested++;
+            }
+
+            if (x >= chunkEnd) {
+                unsigned int chunkCount = (unsigned int)MIN(FRAGMENT_BATCH, spanMaxX - x + 1);
+                edgeFunctionRow(&r[1], &r[2], (float)x, (float)y, chunkCount, edges[0]);
+                edgeFunctionRow(&r[2], &r[0], (float)x, (float)y, chunkCount, edges[1]);
+                edgeFunctionRow(&r[0], &r[1], (float)x, (float)y, chunkCount, edges[2]);
+                chunkX = x;
+                chunkEnd = x + (int)chunkCount;
+            }
+
+            // Area of each point in the triangle, pixels outside of the triangle are skipped
+            float a[3] = { edges[0][x - chunkX], edges[1][x - chunkX], edges[2][x - chunkX] };
+            unsigned int coverage = sampleCoverage(a, edgeX, edgeY, samples);
+            if (coverage == 0)
+                continue;
+
+            inside++;
+            if (touchMap)
+                touchMap[y * width + x]++;
+
+            // Interpolate bary centric coordinate area
+            a[0] /= area;
+            a[1] /= area;
+            a[2] /= area;
+
+            /*
+             * We use the (raster vector) z component we stored inside the raster vectors earlier to check if the pixel is
+             * overlapped by an other pixel using the z-buffer algorithm.
+             *
+             * If the z component is overlapped we do not have to render this pixel as it is not visible on the screen.
+             * Otherwise if the z component is overlapping the old value we store the new z component and queue the
+             * pixel to be shaded
+             */
+            float w = r[0].z * a[0] + r[1].z * a[1] + r[2].z * a[2];
+            if (!multisampled) {
+                if (!depthTest(target->zBuffer, depthFormat, zRow + columnOffset(shift, x - surface->originX), w, depthRange, !query))
+                    continue;
+            }
+            else {
+                size_t offset = (zRow + columnOffset(shift, x - surface->originX)) * samples;
+                unsigned int covered = coverage;
+                coverage = 0;
+
+                for (unsigned int s = 0; s < samples; ++s) {
+                    float sampleW = w + depthPlane[0] * samplePositions[s][0] + depthPlane[1] * samplePositions[s][1];
+                    if ((covered & (1u << s)) && depthTest(target->zBuffer, depthFormat, offset + s, sampleW, depthRange, !query))
+                        coverage |= 1u << s;
+                }
+
+                if (coverage == 0)
+                    continue;
+            }
+
+            if (depthMap)
+                depthMap[y * width + x]++;
+
+            // Depth only triangles are done once the depth is stored, queries only count the passing samples
+            if (mode == SHADE_MODE_DEPTH_ONLY) {
+                visible += query ? sampleCount(coverage) : 0;
+                passed++;
+                continue;
+            }
+
+#if FAST_MATH
+            float z = rcpFast(w);
+#else
+            float z = 1 / w;
+#endif
+
+            // The shading constants are only computed for triangles with a visible fragment
+            if (passed++ == 0)
+                setupShade(mode, triangle, c, r, planes, target->backgroundColor, shadow, &shade);
+
+            // Shade the current span when the fragment does not fit inside of it
+            if (count > 0 && x - fragments[0].x >= FRAGMENT_BATCH) {
+                double start = stats ? timerSeconds() : 0;
+                shadeBatch(mode, multisampled, triangle, &shade, fragments, count, surface, y, shadeRow);
+                shadeTime += stats ? timerSeconds() - start : 0;
+                count = 0;
+            }
+
+            Fragment* fragment = &fragments[count++];
+            fragment->x = x;
+            fragment->z = z;
+            fragment->coverage = coverage;
+            fragment->a[0] = a[0];
+            fragment->a[1] = a[1];
+            fragment->a[2] = a[2];
+
+            // Multiplying by the depth restores the perspective correct attribute, only per pixel lighting uses them
+            if (interpolated) {
+                float column = (float)(x - planeX);
+                for (unsigned int k = 0; k < attributeCount; ++k) {
+                    fragment->attributes[k] = (rowAttributes[k] + planes[k * 3] * column) * z;
+                }
+            }
+
+            if (mode == SHADE_MODE_TEXTURED) {
+                if (x >> 1 != quadX) {
+                    quadX = x >> 1;
+                    lod = quadLod(triangle, planes, depthPlane, &r[0], x, y);
+                }
+                fragment->lod = lod;
+            }
+        }
+
+        if (count > 0) {
+            double start = stats ? timerSeconds() : 0;
+            shadeBatch(mode, multisampled, triangle, &shade, fragments, count, surface, y, shadeRow);
+            shadeTime += stats ? timerSeconds() - start : 0;
+        }
+    }
+
+    if (stats) {
+        stats->pixelsTested += tested;
+        stats->pixelsInside += inside;
+        stats->depthPasses += passed;
+        stats->pixelsShaded += mode == SHADE_MODE_DEPTH_ONLY ? 0 : passed;
+        stats->shadeTime += shadeTime;
+    }
+    return visible;
+}
+
+/**
+ * Rasterize a single triangle using the kernel of a shade mode, multisampling and depth format
+ */
+typedef void (*RasterKernel)(const Frame* frame, const SetupBatch* batch, unsigned int index, const Surface* surface, const Bounds* clip, RasterStats* stats);
+
+/**
+ * Define a raster kernel, an instance of rasterizeTriangle with constant configuration
+ */
+#define RASTER_KERNEL(name, mode, multisampled, depthFormat) \
+    static void name(const Frame* frame, const SetupBatch* batch, unsigned int index, const Surface* surface, const Bounds* clip, RasterStats* stats) { \
+        rasterizeTriangle(frame, batch, index, surface, clip, stats, mode, multisampled, depthFormat, 0); \
+    }
+
+/**
+ * Define the raster kernels of all shade modes for a single multisampling and depth format combination
+ */
+#define RASTER_KERNEL_SET(suffix, multisampled, depthFormat) \
+    RASTER_KERNEL(rasterizeDepthOnly##suffix, SHADE_MODE_DEPTH_ONLY, multisampled, depthFormat) \
+    RASTER_KERNEL(rasterizeFlat##suffix, SHADE_MODE_FLAT, multisampled, depthFormat) \
+    RASTER_KERNEL(rasterizeGouraud##suffix, SHADE_MODE_GOURAUD, multisampled, depthFormat) \
+    RASTER_KERNEL(rasterizePixel##suffix, SHADE_MODE_PIXEL, multisampled, depthFormat) \
+    RASTER_KERNEL(rasterizeTextured##suffix, SHADE_MODE_TEXTURED, multisampled, depthFormat)
+
+RASTER_KERNEL_SET(Float32, 0, DEPTH_FORMAT_FLOAT32)
+RASTER_KERNEL_SET(Unorm16, 0, DEPTH_FORMAT_UNORM16)
+RASTER_KERNEL_SET(Unorm24, 0, DEPTH_FORMAT_UNORM24)
+RASTER_KERNEL_SET(Float32Msaa, 1, DEPTH_FORMAT_FLOAT32)
+RASTER_KERNEL_SET(Unorm16Msaa, 1, DEPTH_FORMAT_UNORM16)
+RASTER_KERNEL_SET(Unorm24Msaa, 1, DEPTH_FORMAT_UNORM24)
+
+/**
+ * Kernels of a set indexed by shade mode, triangles are never set up using SHADE_MODE_DEFAULT
+ */
+#define RASTER_KERNEL_TABLE(suffix) \
+    { NULL, rasterizeDepthOnly##suffix, rasterizeFlat##suffix, rasterizeGouraud##suffix, rasterizePixel##suffix, rasterizeTextured##suffix }
+
+/**
+ * Raster kernels indexed by multisampling, depth format and shade mode
+ */
+static const RasterKernel RASTER_KERNELS[2][3][SHADE_MODE_COUNT] = {
+    { RASTER_KERNEL_TABLE(Float32), RASTER_KERNEL_TABLE(Unorm16), RASTER_KERNEL_TABLE(Unorm24) },
+    { RASTER_KERNEL_TABLE(Float32Msaa), RASTER_KERNEL_TABLE(Unorm16Msaa), RASTER_KERNEL_TABLE(Unorm24Msaa) }
+};
+
+/**
+ * Select the raster kernels of a render target
+ *
+ * @param target Render target
+ * @return Kernels indexed by shade mode
+ */
+static const RasterKernel* selectKernels(const RenderTarget* target) {
+    return RASTER_KERNELS[targetSamples(target) > 1][target->depthFormat];
+}
+
+/**
+ * Test the samples of a single depth only triangle against the zBuffer without storing their depth
+ */
+typedef unsigned long long (*QueryKernel)(const Frame* frame, const SetupBatch* batch, unsigned int index, const Surface* surface, const Bounds* clip, RasterStats* stats);
+
+/**
+ * Define a query kernel, an instance of rasterizeTriangle which only counts the samples passing the depth test
+ */
+#define QUERY_KERNEL(name, multisampled, depthFormat) \
+    static unsigned long long name(const Frame* frame, const SetupBatch* batch, unsigned int index, const Surface* surface, const Bounds* clip, RasterStats* stats) { \
+        return rasterizeTriangle(frame, batch, index, surface, clip, stats, SHADE_MODE_DEPTH_ONLY, multisampled, depthFormat, 1); \
+    }
+
+QUERY_KERNEL(queryFloat32, 0, DEPTH_FORMAT_FLOAT32)
+QUERY_KERNEL(queryUnorm16, 0, DEPTH_FORMAT_UNORM16)
+QUERY_KERNEL(queryUnorm24, 0, DEPTH_FORMAT_UNORM24)
+QUERY_KERNEL(queryFloat32Msaa, 1, DEPTH_FORMAT_FLOAT32)
+QUERY_KERNEL(queryUnorm16Msaa, 1, DEPTH_FORMAT_UNORM16)
+QUERY_KERNEL(queryUnorm24Msaa, 1, DEPTH_FORMAT_UNORM24)
+
+/**
+ * Query kernels indexed by multisampling and depth format
+ */
+static const QueryKernel QUERY_KERNELS[2][3] = {
+    { queryFloat32, queryUnorm16, queryUnorm24 },
+    { queryFloat32Msaa, queryUnorm16Msaa, queryUnorm24Msaa }
+};
+
+/**
+ * Transform the attributes of a vertex to camera space and scale them
+ *
+ * Normals are transformed using the inverse transpose of the linear part of the instance matrix, which keeps
+ * them perpendicular to the surface under non uniform scale and shear. The shading normalizes them again.
+ *
+ * @param attributes Attributes of the vertex in the mesh
+ * @param attributeCount Count of attributes to transform
+ * @param normalOffset Offset of the normal in the attributes, negative when there is none
+ * @param normalMatrix Inverse of the instance matrix, unused without a normal
+ * @param w Factor of all attributes, the raster depth for attributes divided by depth
+ * @param varyings Destination of the transformed attributes
+ */
+static void transformAttributes(const float* attributes, unsigned int attributeCount, int normalOffset, const Matrix4x4* normalMatrix, float w, float* varyings) {
+    for (unsigned int k = 0; k < attributeCount; ++k) { varyings[k] = attributes[k] * w; }
+
+    // Translation does not apply to directions, the rows of the inverse are the columns of its transpose
+    if (normalOffset >= 0) {
+        const float* n = attributes + normalOffset;
+        varyings[normalOffset] = (normalMatrix->p1.x * n[0] + normalMatrix->p1.y * n[1] + normalMatrix->p1.z * n[2]) * w;
+        varyings[normalOffset + 1] = (normalMatrix->p2.x * n[0] + normalMatrix->p2.y * n[1] + normalMatrix->p2.z * n[2]) * w;
+        varyings[normalOffset + 2] = (normalMatrix->p3.x * n[0] + normalMatrix->p3.y * n[1] + normalMatrix->p3.z * n[2]) * w;
+    }
+}
+
+/**
+ * Transform the vertices of all instances to camera and raster space
+ *
+ * Every job transforms an equally sized slice of the concatenated vertices of all instances.
+ */
+static void transformJob(void* context, unsigned int job, unsigned int thread) {
+    Frame* frame = context;
+    const DrawList* drawList = frame->drawList;
+    RasterStats* stats = frame->threadStats ? &frame->threadStats[thread] : NULL;
+    double time = stats ? timerSeconds() : 0;
+
+    float fW = (float)frame->target->width;
+    float fH = (float)frame->target->height;
+
+    unsigned int start = (unsigned int)((unsigned long long)frame->vertexCount * job / frame->threadCount);
+    unsigned int end = (unsigned int)((unsigned long long)frame->vertexCount * (job + 1) / frame->threadCount);
+
+    for (unsigned int i = 0; i < drawList->instanceCount && start < end; ++i) {
+        unsigned int offset = frame->vertexOffsets[i];
+        unsigned int count = drawList->instances[i].mesh->vertexCount;
+        if (start >= offset + count)
+            continue;
+
+        const Vector3* vertices = drawList->instances[i].mesh->vertices;
+        const Matrix4x4* modelViewProjection = &drawList->instances[i].modelViewProjection;
+
+        const Mesh* mesh = drawList->instances[i].mesh;
+        unsigned int attributeCount = mesh->attributes ? MIN(mesh->attributeCount, frame->attributeStride) : 0;
+        int normalOffset = mesh->normalOffset + 3 <= (int)attributeCount ? mesh->normalOffset : -1;
+
+        Matrix4x4 normalMatrix = normalOffset >= 0 ? invertAffineMatrix4x4(modelViewProjection) : (Matrix4x4) { { 0 } };
+
+        while (start < end && start < offset + count) {
+            unsigned int batchCount = MIN(MIN(end, offset + count) - start, TRANSFORM_BATCH);
+            float x[TRANSFORM_BATCH], y[TRANSFORM_BATCH], z[TRANSFORM_BATCH];
+
+            // The vertices are transformed as separate component arrays, the frame keeps them as vectors
+            for (unsigned int k = 0; k < batchCount; ++k) {
+                const Vector3* v = vertices + (start - offset) + k;
+                x[k] = v->x;
+                y[k] = v->y;
+                z[k] = v->z;
+            }
+
+            transformVec3Batch(x, y, z, batchCount, modelViewProjection, x, y, z);
+            cameraToRasterBatch(x, y, z, batchCount, fW, fH, frame->wAspect, frame->hAspect, frame->target->nearClipping, frame->raster + start);
+
+            for (unsigned int k = 0; k < batchCount; ++k, ++start) {
+                frame->camera[start] = (Vector3) { x[k], y[k], z[k] };
+
+                if (attributeCount == 0)
+                    continue;
+
+                const float* attributes = mesh->attributes + (size_t)(start - offset) * mesh->attributeCount;
+                float* varyings = frame->varyings + (size_t)start * frame->attributeStride;
+                transformAttributes(attributes, attributeCount, normalOffset, &normalMatrix, frame->raster[start].z, varyings);
+            }
+        }
+    }
+
+    if (stats)
+        stats->transformTime += timerSeconds() - time;
+}
+
+/**
+ * Compute the screen space plane equations of the attributes of a triangle
+ *
+ * The barycentric weight of a vertex is the edge function of the opposite edge divided by the triangle area,
+ * which is linear in x and y. The gradients of an attribute are therefore the sum of the attribute values
+ * weighted by the gradients of the edge functions.
+ *
+ * @param r Triangle in raster space
+ * @param v Attributes of each vertex, divided by depth
+ * @param attributeCount Count of attributes
+ * @param area Area of the triangle (edge function of its vertices)
+ * @param planes Destination of the planes, three floats per attribute
+ */
+static void setupAttributes(const Vector3* r[3], const float* v[3], unsigned int attributeCount, float area, float* planes) {
+    float inverseArea = 1 / area;
+    float dx[3] = { r[2]->y - r[1]->y, r[0]->y - r[2]->y, r[1]->y - r[0]->y };
+    float dy[3] = { r[1]->x - r[2]->x, r[2]->x - r[0]->x, r[0]->x - r[1]->x };
+
+    for (unsigned int k = 0; k < attributeCount; ++k) {
+        planes[k * 3] = (v[0][k] * dx[0] + v[1][k] * dx[1] + v[2][k] * dx[2]) * inverseArea;
+        planes[k * 3 + 1] = (v[0][k] * dy[0] + v[1][k] * dy[1] + v[2][k] * dy[2]) * inverseArea;
+        planes[k * 3 + 2] = v[0][k];
+    }
+}
+
+/**
+ * Set up a single triangle and append it to the triangles of a setup job
+ *
+ * Triangles are culled when their bounding box is outside of the image, when they do not cover any area or
+ * when they are facing away from the camera (counter clockwise). Small triangles (see SMALL_TRIANGLE_SIZE) are
+ * also culled when they do not cover any sample.
+ *
+ * @param frame Frame which is drawn
+ * @param batch Triangles of the setup job
+ * @param source Triangle to set up, its vertices, attribute layout and texture are copied
+ * @param r Triangle in raster space
+ * @param varyings Attributes of each vertex divided by depth, only used when the triangle has attributes
+ * @return Reason the triangle was culled, CULL_NONE when it was appended
+ */
+static CullReason setupTriangle(const Frame* frame, SetupBatch* batch, const Triangle* source, const Vector3* r[3], const float* varyings[3]) {
+    const Bounds* scissor = &frame->scissor;
+
+    // Samples are up to half a pixel away from the pixel position, which extends the pixels a triangle can cover
+    unsigned int samples = targetSamples(frame->target);
+    float margin = samples > 1 ? .5f : 0;
+
+    // Calculate triangle bounding box (based on triangle in raster space)
+    float rMaxY = MAX3(r[0]->y, r[1]->y, r[2]->y) + margin;
+    float rMinY = MIN3(r[0]->y, r[1]->y, r[2]->y) - margin;
+    float rMaxX = MAX3(r[0]->x, r[1]->x, r[2]->x) + margin;
+    float rMinX = MIN3(r[0]->x, r[1]->x, r[2]->x) - margin;
+
+    /*
+     * We test weather the box is completely out side of the raster image dimensions (or the scissor rectangle)
+     * if this is true we can immediately cull the triangle
+     */
+    if (rMinX > (float)scissor->maxX || rMaxX < (float)scissor->minX || rMinY > (float)scissor->maxY || rMaxY < (float)scissor->minY)
+        return CULL_OUTSIDE;
+
+    float area = edgeFunction(r[0], r[1], r[2]);
+
+    // The negated comparison also culls triangles with an invalid (NaN) area
+    if (!(area != 0))
+        return CULL_ZERO_AREA;
+
+    if (area < 0)
+        return CULL_BACK_FACING;
+
+    // Calculate raster image bounding box
+    Bounds bounds = {
+        .minX = MAX(scissor->minX, (int)floorf(rMinX)),
+        .minY = MAX(scissor->minY, (int)floorf(rMinY)),
+        .maxX = MIN(scissor->maxX, (int)floorf(rMaxX)),
+        .maxY = MIN(scissor->maxY, (int)floorf(rMaxY))
+    };
+
+    int boxWidth = bounds.maxX - bounds.minX + 1;
+    int boxHeight = bounds.maxY - bounds.minY + 1;
+
+    /*
+     * Small triangles test the pixels of their bounding box right away, triangles which do not cover
+     * any sample are dropped before their attributes are set up
+     */
+    unsigned int pixelMask = 0;
+    if (boxWidth <= SMALL_TRIANGLE_SIZE && boxHeight <= SMALL_TRIANGLE_SIZE) {
+        Vector3 v[3] = { *r[0], *r[1], *r[2] };
+        float edgeX[3] = { v[2].y - v[1].y, v[0].y - v[2].y, v[1].y - v[0].y };
+        float edgeY[3] = { v[1].x - v[2].x, v[2].x - v[0].x, v[0].x - v[1].x };
+        float a[3];
+
+        for (int y = 0; y < boxHeight; ++y) {
+            for (int x = 0; x < boxWidth; ++x) {
+                if (pixelCoverage(v, edgeX, edgeY, samples, bounds.minX + x, bounds.minY + y, a))
+                    pixelMask |= 1u << (y * SMALL_TRIANGLE_SIZE + x);
+            }
+        }
+
+        if (pixelMask == 0)
+            return CULL_MISSED;
+    }
+
+    // Grow the storage of the setup job, only clipped triangles can exceed the triangles of its slice
+    if (batch->count == batch->capacity)
+        reserveTriangles(batch, batch->capacity * 2 + 16, frame->attributeStride);
+
+    Triangle* triangle = &batch->triangles[batch->count];
+    *triangle = *source;
+    triangle->bounds = bounds;
+    triangle->area = area;
+    triangle->pixelMask = pixelMask;
+
+    /*
+     * Large and thin (diagonal) triangles waste most of their bounding box, the span computation per row
+     * pays off when the uncovered part of the box is larger than its cost
+     */
+    triangle->scanline = (float)(boxWidth * boxHeight) - area * .5f > (float)boxHeight * SCANLINE_ROW_COST;
+
+    if (triangle->attributeCount > 0)
+        setupAttributes(r, varyings, triangle->attributeCount, area, batch->planes + (size_t)batch->count * frame->attributeStride * 3);
+
+    batch->count++;
+    return CULL_NONE;
+}
+
+/**
+ * Clip a convex polygon in camera space against a single plane
+ *
+ * @param input Vertices of the polygon
+ * @param count Count of vertices of the polygon
+ * @param plane Plane as x, y, z coefficient and offset, points with a positive distance are kept
+ * @param attributeCount Count of attributes of each vertex
+ * @param output Destination of the clipped polygon, able to store CLIP_MAX_VERTICES vertices
+ * @return Count of vertices of the clipped polygon
+ */
+static unsigned int clipPolygon(const ClipVertex* input, unsigned int count, const float plane[4], unsigned int attributeCount, ClipVertex* output) {
+    unsigned int outputCount = 0;
+
+    for (unsigned int i = 0; i < count; ++i) {
+        const ClipVertex* a = &input[i];
+        const ClipVertex* b = &input[(i + 1) % count];
+        float distanceA = plane[0] * a->camera.x + plane[1] * a->camera.y + plane[2] * a->camera.z + plane[3];
+        float distanceB = plane[0] * b->camera.x + plane[1] * b->camera.y + plane[2] * b->camera.z + plane[3];
+
+        if (distanceA >= 0 && outputCount < CLIP_MAX_VERTICES)
+            output[outputCount++] = *a;
+
+        // The edge crosses the plane, the intersection is added between both vertices
+        if ((distanceA >= 0) != (distanceB >= 0) && outputCount < CLIP_MAX_VERTICES) {
+            float t = distanceA / (distanceA - distanceB);
+            ClipVertex* vertex = &output[outputCount++];
+
+            vertex->camera.x = a->camera.x + (b->camera.x - a->camera.x) * t;
+            vertex->camera.y = a->camera.y + (b->camera.y - a->camera.y) * t;
+            vertex->camera.z = a->camera.z + (b->camera.z - a->camera.z) * t;
+            for (unsigned int k = 0; k < attributeCount; ++k) {
+                vertex->attributes[k] = a->attributes[k] + (b->attributes[k] - a->attributes[k]) * t;
+            }
+        }
+    }
+
+    return outputCount;
+}
+
+/**
+ * Clip a triangle against the near plane and the guard band and set up the triangles of the clipped polygon
+ *
+ * Attributes are linear in camera space, they are interpolated without the division by depth. The vertices
+ * of the clipped polygon are stored in the clip vertices of the setup job, the polygon is split into a fan
+ * of triangles which keeps the winding order of the triangle.
  *
- * Camera coordinates are defined in the range of -1 to 1.
- * We need to map the coordinate to there respective raster coordinate which is
- * defined by the width and height of the screen pixels.
+ * @param frame Frame which is drawn
+ * @param batch Triangles of the setup job
+ * @param source Triangle to clip, referencing the transformed vertices of the frame
+ * @param instance Instance of the triangle
+ * @param vertexOffset Index of the first vertex of the instance in the transformed vertices of the frame
+ * @return Count of triangles which were appended
+ */
+static unsigned int clipTriangle(const Frame* frame, SetupBatch* batch, const Triangle* source, const Instance* instance, unsigned int vertexOffset) {
+    ClipVertex polygons[2][CLIP_MAX_VERTICES];
+    unsigned int attributeCount = source->attributeCount;
+    unsigned int count = 3;
+
+    /*
+     * The stored attributes are divided by depth, which has no inverse for vertices in the camera plane. The
+     * attributes are transformed again from the mesh instead.
+     */
+    const Mesh* mesh = instance->mesh;
+    Matrix4x4 normalMatrix = source->normalOffset >= 0 ? invertAffineMatrix4x4(&instance->modelViewProjection) : (Matrix4x4) { { 0 } };
+
+    for (int i = 0; i < 3; ++i) {
+        ClipVertex* vertex = &polygons[0][i];
+        vertex->camera = frame->camera[source->v[i]];
+
+        if (attributeCount > 0) {
+            const float* attributes = mesh->attributes + (size_t)(source->v[i] - vertexOffset) * mesh->attributeCount;
+            transformAttributes(attributes, attributeCount, source->normalOffset, &normalMatrix, 1, vertex->attributes);
+        }
+    }
+
+    int current = 0;
+    for (int i = 0; i < CLIP_PLANE_COUNT && count >= 3; ++i) {
+        count = clipPolygon(polygons[current], count, frame->clipPlanes[i], attributeCount, polygons[1 - current]);
+        current = 1 - current;
+    }
+
+    if (count < 3)
+        return 0;
+
+    float fW = (float)frame->target->width;
+    float fH = (float)frame->target->height;
+
+    if (batch->clipCount + count > batch->clipCapacity) {
+        batch->clipCapacity = batch->clipCapacity * 2 + CLIP_MAX_VERTICES;
+        batch->clipCamera = realloc(batch->clipCamera, batch->clipCapacity * sizeof(Vector3));
+        batch->clipRaster = realloc(batch->clipRaster, batch->clipCapacity * sizeof(Vector3));
+    }
+
+    // Clip vertices are indexed after the transformed vertices, mergeClipVertices moves them into the frame
+    unsigned int first = batch->clipCount;
+    float varyings[CLIP_MAX_VERTICES][MAX_ATTRIBUTES];
+    for (unsigned int i = 0; i < count; ++i) {
+        ClipVertex* vertex = &polygons[current][i];
+        batch->clipCamera[first + i] = vertex->camera;
+        batch->clipRaster[first + i] = cameraToRaster(&vertex->camera, fW, fH, frame->wAspect, frame->hAspect, frame->target->nearClipping);
+
+        for (unsigned int k = 0; k < attributeCount; ++k) { varyings[i][k] = vertex->attributes[k] * batch->clipRaster[first + i].z; }
+    }
+    batch->clipCount += count;
+
+    unsigned int appended = 0;
+    for (unsigned int i = 1; i + 1 < count; ++i) {
+        unsigned int corners[3] = { first, first + i, first + i + 1 };
+        Triangle triangle = *source;
+        const Vector3* r[3];
+        const float* v[3];
+
+        for (int k = 0; k < 3; ++k) {
+            triangle.v[k] = frame->vertexCount + corners[k];
+            r[k] = &batch->clipRaster[corners[k]];
+            v[k] = varyings[corners[k] - first];
+        }
+
+        // Parts of the polygon are culled silently, the triangle is counted as clipped
+        if (setupTriangle(frame, batch, &triangle, r, v) == CULL_NONE)
+            appended++;
+    }
+
+    return appended;
+}
+
+/**
+ * Cull the triangles of a slice of all instances and compute the bounding box of the remaining triangles
+ *
+ * Triangles are culled when they are completely behind the camera or outside of the image (frustum),
+ * when they do not cover any area or when they are facing away from the camera (counter clockwise), see
+ * setupTriangle. Triangles which cross the near plane or leave the guard band (see GUARD_BAND) are clipped
+ * geometrically, all other triangles are rasterized directly with their bounding box limited to the image.
+ */
+static void setupJob(void* context, unsigned int job, unsigned int thread) {
+    Frame* frame = context;
+    const DrawList* drawList = frame->drawList;
+    RasterStats* stats = frame->threadStats ? &frame->threadStats[thread] : NULL;
+    double time = stats ? timerSeconds() : 0;
+
+    // Raster coordinates inside of the guard band are rasterized without clipping
+    float guardMinX = -(float)GUARD_BAND;
+    float guardMinY = -(float)GUARD_BAND;
+    float guardMaxX = (float)frame->target->width + (float)GUARD_BAND;
+    float guardMaxY = (float)frame->target->height + (float)GUARD_BAND;
+
+    unsigned int start = (unsigned int)((unsigned long long)frame->triangleCount * job / frame->threadCount);
+    unsigned int end = (unsigned int)((unsigned long long)frame->triangleCount * (job + 1) / frame->threadCount);
+
+    SetupBatch* batch = &frame->batches[job];
+    float near = frame->target->nearClipping;
+    unsigned long long counts[CULL_REASON_COUNT] = { 0 };
+    unsigned long long clipped = 0;
+
+    for (unsigned int i = 0; i < drawList->instanceCount && start < end; ++i) {
+        unsigned int offset = frame->triangleOffsets[i];
+        const Mesh* mesh = drawList->instances[i].mesh;
+        if (start >= offset + mesh->indicesCount / 3)
+            continue;
+
+        unsigned int vertexOffset = frame->vertexOffsets[i] - 1;
+        unsigned int attributeCount = mesh->attributes ? MIN(mesh->attributeCount, frame->attributeStride) : 0;
+        int normalOffset = mesh->normalOffset + 3 <= (int)attributeCount ? mesh->normalOffset : -1;
+        int texcoordOffset = mesh->texcoordOffset + 2 <= (int)attributeCount ? mesh->texcoordOffset : -1;
+        const Texture* texture = texcoordOffset >= 0 ? drawList->instances[i].texture : NULL;
+
+        // Instances without a texture fall back to per pixel lighting
+        ShadeMode shadeMode = frame->state.shadeMode;
+        if (shadeMode == SHADE_MODE_DEFAULT || shadeMode == SHADE_MODE_TEXTURED)
+            shadeMode = texture ? SHADE_MODE_TEXTURED : SHADE_MODE_PIXEL;
+
+        Triangle triangle = {
+            .attributeCount = attributeCount,
+            .normalOffset = normalOffset,
+            .texcoordOffset = texcoordOffset,
+            .texture = shadeMode == SHADE_MODE_TEXTURED ? texture : NULL,
+            .shadeMode = shadeMode
+        };
+
+        for (; start < end && start < offset + mesh->indicesCount / 3; ++start) {
+            const unsigned int* index = mesh->indices + (start - offset) * 3;
+
+            triangle.v[0] = vertexOffset + index[0];
+            triangle.v[1] = vertexOffset + index[1];
+            triangle.v[2] = vertexOffset + index[2];
+
+            const Vector3* c[3] = { &frame->camera[triangle.v[0]], &frame->camera[triangle.v[1]], &frame->camera[triangle.v[2]] };
+            const Vector3* r[3] = { &frame->raster[triangle.v[0]], &frame->raster[triangle.v[1]], &frame->raster[triangle.v[2]] };
+
+            int behind = (c[0]->z > -near) + (c[1]->z > -near) + (c[2]->z > -near);
+            if (behind == 3) {
+                counts[CULL_OUTSIDE]++;
+                continue;
+            }
+
+            int outsideGuardBand = 0;
+            for (int k = 0; k < 3; ++k) {
+                outsideGuardBand |= !(r[k]->x >= guardMinX && r[k]->x <= guardMaxX && r[k]->y >= guardMinY && r[k]->y <= guardMaxY);
+            }
+
+            if (behind > 0 || outsideGuardBand) {
+                /*
+                 * Vertices behind the camera do not have a raster position, the winding is tested in camera space
+                 * using the side of the triangle plane the camera is on
+                 */
+                Vector3 line1 = subVec3(c[1], c[0]);
+                Vector3 line2 = subVec3(c[2], c[0]);
+                Vector3 normal = crossVec3(&line1, &line2);
+                if (!(dotVec3(&normal, c[0]) < 0)) {
+                    counts[dotVec3(&normal, c[0]) > 0 ? CULL_BACK_FACING : CULL_ZERO_AREA]++;
+                    continue;
+                }
+
+                if (clipTriangle(frame, batch, &triangle, &drawList->instances[i], frame->vertexOffsets[i]) > 0)
+                    clipped++;
+                else
+                    counts[CULL_OUTSIDE]++;
+                continue;
+            }
+
+            const float* varyings[3] = { NULL, NULL, NULL };
+            if (attributeCount > 0) {
+                for (int k = 0; k < 3; ++k) { varyings[k] = frame->varyings + (size_t)triangle.v[k] * frame->attributeStride; }
+            }
+            counts[setupTriangle(frame, batch, &triangle, r, varyings)]++;
+        }
+    }
+
+    if (stats) {
+        stats->trianglesOutside += counts[CULL_OUTSIDE];
+        stats->trianglesZeroArea += counts[CULL_ZERO_AREA];
+        stats->trianglesBackFacing += counts[CULL_BACK_FACING];
+        stats->trianglesMissed += counts[CULL_MISSED];
+        stats->trianglesClipped += clipped;
+        stats->setupTime += timerSeconds() - time;
+    }
+}
+
+/**
+ * Move the clip vertices of all setup jobs behind the transformed vertices of the frame
+ *
+ * Triangles reference the clip vertices of their setup job by their index after the transformed vertices,
+ * the indices of the later jobs are moved by the clip vertices of the jobs before them.
+ *
+ * @param frame Frame which is drawn
+ */
+static void mergeClipVertices(Frame* frame) {
+    unsigned int total = 0;
+    for (unsigned int i = 0; i < frame->threadCount; ++i) { total += frame->batches[i].clipCount; }
+
+    if (total == 0)
+        return;
+
+    frame->camera = reserveBuffer(&frame->storage->camera, ((size_t)frame->vertexCount + total) * sizeof(Vector3));
+    frame->raster = reserveBuffer(&frame->storage->raster, ((size_t)frame->vertexCount + total) * sizeof(Vector3));
+
+    unsigned int offset = 0;
+    for (unsigned int i = 0; i < frame->threadCount; ++i) {
+        SetupBatch* batch = &frame->batches[i];
+        if (batch->clipCount == 0)
+            continue;
+
+        memcpy(frame->camera + frame->vertexCount + offset, batch->clipCamera, batch->clipCount * sizeof(Vector3));
+        memcpy(frame->raster + frame->vertexCount + offset, batch->clipRaster, batch->clipCount * sizeof(Vector3));
+
+        if (offset > 0) {
+            for (unsigned int j = 0; j < batch->count; ++j) {
+                for (int k = 0; k < 3; ++k) {
+                    if (batch->triangles[j].v[k] >= frame->vertexCount)
+                        batch->triangles[j].v[k] += offset;
+                }
+            }
+        }
+        offset += batch->clipCount;
+    }
+}
+
+/**
+ * Rasterize the triangles of all instances which overlap a single horizontal band of the raster rows
  *
- * @param v Camera vector
- * @param width Width in pixels of the screen
- * @param height Height in pixels of the screen
- * @param wAspect Corrected scale x
- * @param hAspect Corrected scale y
- * @return Returns a vector3 defined in raster space coordinate. The actual coordinate is a Vector2 but the inverted z component is added
- *         to later be used in rasterisation depth.
+ * The triangles are walked in the order of the setup jobs, which keeps the submission order intact.
  */
-static Vector3 cameraToRaster(Vector3* v, float width, float height, float wAspect, float hAspect){
-    return (Vector3) {
-        .x = (1 + NEAR_CLIPPING * (v->x * wAspect) / -v->z) * 0.5f * width,
-        .y = (1 - NEAR_CLIPPING * (v->y * hAspect) / -v->z) * 0.5f * height,
-        .z = 1 / -v->z
+static void rasterJob(void* context, unsigned int job, unsigned int thread) {
+    Frame* frame = context;
+    RasterStats* stats = frame->threadStats ? &frame->threadStats[thread] : NULL;
+    double time = stats ? timerSeconds() : 0;
+    double shadeTime = stats ? stats->shadeTime : 0;
+
+    const Bounds* rows = &frame->rasterRows;
+    unsigned int height = (unsigned int)(rows->maxY - rows->minY + 1);
+
+    Bounds band = {
+        .minX = rows->minX,
+        .minY = rows->minY + (int)((unsigned long long)height * job / frame->bandCount),
+        .maxX = rows->maxX,
+        .maxY = rows->minY + (int)((unsigned long long)height * (job + 1) / frame->bandCount) - 1
     };
+
+    if (band.maxY < band.minY)
+        return;
+
+    const RasterKernel* kernels = selectKernels(frame->target);
+    QueryKernel query = frame->querySamples ? QUERY_KERNELS[targetSamples(frame->target) > 1][frame->target->depthFormat] : NULL;
+    unsigned long long visible = 0;
+
+    for (unsigned int i = 0; i < frame->threadCount; ++i) {
+        const SetupBatch* batch = &frame->batches[i];
+        const unsigned int* bin = frame->bins ? frame->bins[i] : NULL;
+        unsigned int first = 0;
+        unsigned int end = batch->count;
+
+        if (bin) {
+            const unsigned int* offsets = frame->binOffsets + (size_t)i * (frame->tileCount + 1);
+            first = offsets[frame->strip];
+            end = offsets[frame->strip + 1];
+        }
+
+        for (unsigned int j = first; j < end; ++j) {
+            unsigned int index = bin ? bin[j] : j;
+            const Triangle* triangle = &batch->triangles[index];
+            if (triangle->bounds.minY > band.maxY || triangle->bounds.maxY < band.minY)
+                continue;
+
+            if (query)
+                visible += query(frame, batch, index, &frame->rasterSurface, &band, stats);
+            else
+                kernels[triangle->shadeMode](frame, batch, index, &frame->rasterSurface, &band, stats);
+        }
+    }
+
+    if (query)
+        frame->querySamples[thread] += visible;
+
+    // Shading is timed separately, the remaining time is spent on rasterization
+    if (stats)
+        stats->rasterTime += timerSeconds() - time - (stats->shadeTime - shadeTime);
 }
 
 /**
- * This functions calculates the shade value of a point based on the angle of the triangle in relation to the camera
- * (using the cross product) and uses bary centric coordinates to get an interpolated color inside the triangle its self.
+ * Sort the triangles of a setup job into the bins of the tiles (or strips) their bounding box overlaps
  *
- * @param z Barycentric z component of the pixel
- * @param c Triangle in camera space
- * @param a Barycentric area of each triangle point
- * @return Returns a char which represents the shaded value.
+ * Triangles are appended to the bins in setup order, which keeps the submission order intact within every tile.
  */
-static unsigned char getPixelShade(float z, Vector3 c[3], const float a[3]) {
-    /*
-     * Interpolate correct shade value distribution using barycentric coordinate system.
-     * Later this value will be used as scalar value together with the actual triangle shade color.
-     */
-    float px = (c[0].x / -c[0].z) * a[0] + (c[1].x / -c[1].z) * a[1] + (c[2].x / -c[2].z) * a[2];
-    float py = (c[0].y / -c[0].z) * a[0] + (c[1].y / -c[1].z) * a[1] + (c[2].y / -c[2].z) * a[2];
+static void binJob(void* context, unsigned int job, unsigned int thread) {
+    Frame* frame = context;
+    RasterStats* stats = frame->threadStats ? &frame->threadStats[thread] : NULL;
+    double time = stats ? timerSeconds() : 0;
 
-    Vector3 viewDirection = {px * -z, py * -z, z };
-    Vector3 nViewDirection = normalizeVec3(&viewDirection);
+    SetupBatch* batch = &frame->batches[job];
+    const Triangle* triangles = batch->triangles;
+    unsigned int* offsets = frame->binOffsets + (size_t)job * (frame->tileCount + 1);
+    memset(offsets, 0, (frame->tileCount + 1) * sizeof(unsigned int));
+
+    // Count the triangles of every tile, the count of tile t is stored at t + 1
+    for (unsigned int i = 0; i < batch->count; ++i) {
+        const Bounds* bounds = &triangles[i].bounds;
+        for (int y = bounds->minY >> frame->binShiftY; y <= bounds->maxY >> frame->binShiftY; ++y) {
+            for (int x = bounds->minX >> frame->binShiftX; x <= bounds->maxX >> frame->binShiftX; ++x) {
+                offsets[y * frame->tilesX + x + 1]++;
+            }
+        }
+    }
 
-    Vector3 line1 = subVec3(&c[1], &c[0]);
-    Vector3 line2 = subVec3(&c[2], &c[0]);
-    Vector3 cross = crossVec3(&line1, &line2);
+    for (unsigned int i = 0; i < frame->tileCount; ++i) { offsets[i + 1] += offsets[i]; }
 
-    Vector3 nCamera = normalizeVec3(&cross);
+    // The bins are stored in the buffers of the setup job, which are kept with the storage of the frame
+    unsigned int* bins = reserveBuffer(&batch->bin, MAX(1, offsets[frame->tileCount]) * sizeof(unsigned int));
+    unsigned int* cursors = reserveBuffer(&batch->cursors, frame->tileCount * sizeof(unsigned int));
+    memcpy(cursors, offsets, frame->tileCount * sizeof(unsigned int));
 
-    return (unsigned char)(MAX(0, dotVec3(&nCamera, &nViewDirection)) * 255);
+    for (unsigned int i = 0; i < batch->count; ++i) {
+        const Bounds* bounds = &triangles[i].bounds;
+        for (int y = bounds->minY >> frame->binShiftY; y <= bounds->maxY >> frame->binShiftY; ++y) {
+            for (int x = bounds->minX >> frame->binShiftX; x <= bounds->maxX >> frame->binShiftX; ++x) {
+                bins[cursors[y * frame->tilesX + x]++] = i;
+            }
+        }
+    }
+
+    frame->bins[job] = bins;
+
+    if (stats)
+        stats->setupTime += timerSeconds() - time;
 }
 
 /**
- * Rasterize a single triangle and draw into the frameBuffer
+ * Copy the pixels of a tile between a render target and the local buffers of the tile
  *
- * @param c Triangle in camera space
- * @param r Triangle in raster space
- * @param zBuffer Pointer to buffer which stores depth information of triangles
- * @param frameBuffer Pointer to buffer which stores the raster image
- * @param backgroundColor Background color of the framebuffer
- * @param width Width of the image in pixels
- * @param height Height of the image in pixels
+ * Tiles start at a multiple of the tile size, every row of a tile is therefore contiguous in all layouts.
+ *
+ * @param target Render target
+ * @param tile Local buffers of the tile, a linear target of the size of a tile
+ * @param bounds Pixels to copy, inside of the tile
+ * @param depth Non zero to copy the depth values, otherwise the colors are copied
+ * @param store Non zero to copy from the tile to the render target, otherwise from the render target to the tile
  */
-static void rasterizeTriangle(
-        Vector3 c[3],
-        Vector3 r[3],
-        float* zBuffer,
-        unsigned char* frameBuffer,
-        unsigned char backgroundColor,
+static void copyTile(const RenderTarget* target, const Surface* tile, const Bounds* bounds, int depth, int store) {
+    unsigned int samples = targetSamples(target);
+    unsigned int elementSize = depth ? depthFormatSize(target->depthFormat) : colorFormatSize(target->colorFormat);
+    unsigned char* targetBuffer = depth ? target->zBuffer : target->frameBuffer;
+    unsigned char* tileBuffer = depth ? tile->target->zBuffer : tile->target->frameBuffer;
+    unsigned int shift = tileShift(target);
+
+    size_t rowSize = (size_t)(bounds->maxX - bounds->minX + 1) * samples * elementSize;
+    for (int y = bounds->minY; y <= bounds->maxY; ++y) {
+        unsigned char* targetRow = targetBuffer + (rowOffset(target, y) + columnOffset(shift, bounds->minX)) * samples * elementSize;
+        unsigned char* tileRow = tileBuffer + (rowOffset(tile->target, y - tile->originY) + (size_t)(bounds->minX - tile->originX)) * samples * elementSize;
+
+        if (store)
+            memcpy(targetRow, tileRow, rowSize);
+        else
+            memcpy(tileRow, targetRow, rowSize);
+    }
+}
+
+/**
+ * Rasterize the triangles of a single tile into the local buffers of the thread and write the tile back
+ */
+static void tileJob(void* context, unsigned int job, unsigned int thread) {
+    Frame* frame = context;
+    const RenderTarget* target = frame->target;
+    RasterStats* stats = frame->threadStats ? &frame->threadStats[thread] : NULL;
+    double time = stats ? timerSeconds() : 0;
+    double shadeTime = stats ? stats->shadeTime : 0;
+
+    unsigned int tileSize = 1u << TILE_SHIFT;
+    unsigned int samples = targetSamples(target);
+    size_t tilePixels = (size_t)tileSize * tileSize * samples;
+    int depthStored = frame->drawList->mode == DRAW_MODE_TILED;
+    int colored = frame->tileColors != NULL;
+
+    int tileX = (int)(job % frame->tilesX) << TILE_SHIFT;
+    int tileY = (int)(job / frame->tilesX) << TILE_SHIFT;
+    Bounds bounds = {
+        .minX = MAX(frame->scissor.minX, tileX),
+        .minY = MAX(frame->scissor.minY, tileY),
+        .maxX = MIN(frame->scissor.maxX, tileX + (int)tileSize - 1),
+        .maxY = MIN(frame->scissor.maxY, tileY + (int)tileSize - 1)
+    };
+
+    // Tiles outside of the scissor rectangle are neither loaded nor written back
+    if (bounds.minX > bounds.maxX || bounds.minY > bounds.maxY)
+        return;
+
+    RenderTarget tile = {
+        .zBuffer = frame->tileDepths + tilePixels * depthFormatSize(target->depthFormat) * thread,
+        .frameBuffer = colored ? frame->tileColors + tilePixels * colorFormatSize(target->colorFormat) * thread : NULL,
+        .backgroundColor = target->backgroundColor,
+        .width = tileSize,
+        .height = tileSize,
+        .colorFormat = target->colorFormat,
+        .depthFormat = target->depthFormat,
+        .layout = TARGET_LAYOUT_LINEAR,
+        .sampleCount = samples,
+        .nearClipping = target->nearClipping,
+        .farClipping = target->farClipping
+    };
+    Surface surface = { &tile, tileX, tileY };
+    const RasterKernel* kernels = selectKernels(target);
+
+    if (colored)
+        copyTile(target, &surface, &bounds, 0, 0);
+    if (depthStored)
+        copyTile(target, &surface, &bounds, 1, 0);
+    else
+        clearDepth(tile.zBuffer, tile.depthFormat, tilePixels, target->farClipping);
+
+    for (unsigned int i = 0; i < frame->threadCount; ++i) {
+        const unsigned int* offsets = frame->binOffsets + (size_t)i * (frame->tileCount + 1);
+
+        for (unsigned int j = offsets[job]; j < offsets[job + 1]; ++j) {
+            const SetupBatch* batch = &frame->batches[i];
+            unsigned int index = frame->bins[i][j];
+            kernels[batch->triangles[index].shadeMode](frame, batch, index, &surface, &bounds, stats);
+        }
+    }
+
+    // The color is written back once, the depth only when it is needed after the draw
+    if (colored)
+        copyTile(target, &surface, &bounds, 0, 1);
+    if (depthStored)
+        copyTile(target, &surface, &bounds, 1, 1);
+
+    if (stats)
+        stats->rasterTime += timerSeconds() - time - (stats->shadeTime - shadeTime);
+}
+
+PipelineState defaultPipelineState(void) {
+    return (PipelineState) {
+        .deviceAspect = DEVICE_ASPECT,
+        .shadeMode = SHADE_MODE_DEFAULT
+    };
+}
+
+void addRasterStats(RasterStats* total, const RasterStats* stats) {
+    total->trianglesSubmitted += stats->trianglesSubmitted;
+    total->trianglesBackFacing += stats->trianglesBackFacing;
+    total->trianglesOutside += stats->trianglesOutside;
+    total->trianglesZeroArea += stats->trianglesZeroArea;
+    total->trianglesMissed += stats->trianglesMissed;
+    total->trianglesClipped += stats->trianglesClipped;
+    total->pixelsTested += stats->pixelsTested;
+    total->pixelsInside += stats->pixelsInside;
+    total->depthPasses += stats->depthPasses;
+    total->pixelsShaded += stats->pixelsShaded;
+    total->transformTime += stats->transformTime;
+    total->setupTime += stats->setupTime;
+    total->rasterTime += stats->rasterTime;
+    total->shadeTime += stats->shadeTime;
+}
+
+unsigned int colorFormatSize(ColorFormat colorFormat) {
+    switch (colorFormat) {
+        case COLOR_FORMAT_RGB8: return 3;
+        case COLOR_FORMAT_RGBA8: return 4;
+        case COLOR_FORMAT_NONE: return 0;
+        default: return 1;
+    }
+}
+
+unsigned int depthFormatSize(DepthFormat depthFormat) {
+    switch (depthFormat) {
+        case DEPTH_FORMAT_UNORM16: return 2;
+        default: return 4;
+    }
+}
+
+size_t renderTargetPixelCount(const RenderTarget* target) {
+    unsigned int shift = tileShift(target);
+    size_t tilesX = (target->width + (1u << shift) - 1) >> shift;
+    size_t tilesY = (target->height + (1u << shift) - 1) >> shift;
+    return (tilesX * tilesY) << (shift * 2);
+}
+
+RenderTarget createRenderTarget(
         unsigned int width,
-        unsigned int height) {
-    unsigned int w = width - 1;
-    unsigned int h = height - 1;
+        unsigned int height,
+        ColorFormat colorFormat,
+        DepthFormat depthFormat,
+        TargetLayout layout,
+        unsigned int sampleCount,
+        unsigned char backgroundColor) {
 
-    // Calculate triangle bounding box (based on triangle in raster space)
-    float rMaxY = MAX3(r[0].y, r[1].y, r[2].y);
-    float rMinY = MIN3(r[0].y, r[1].y, r[2].y);
-    float rMaxX = MAX3(r[0].x, r[1].x, r[2].x);
-    float rMinX = MIN3(r[0].x, r[1].x, r[2].x);
+    RenderTarget target = {
+        .backgroundColor = backgroundColor,
+        .width = width,
+        .height = height,
+        .colorFormat = colorFormat,
+        .depthFormat = depthFormat,
+        .layout = layout,
+        .sampleCount = sampleCount,
+        .nearClipping = NEAR_CLIPPING,
+        .farClipping = FAR_CLIPPING
+    };
+
+    target.sampleCount = targetSamples(&target);
+    size_t size = renderTargetPixelCount(&target) * target.sampleCount;
+    target.zBuffer = malloc(size * depthFormatSize(depthFormat));
+    if (colorFormat != COLOR_FORMAT_NONE)
+        target.frameBuffer = malloc(size * colorFormatSize(colorFormat));
+    return target;
+}
+
+void freeRenderTarget(RenderTarget* target) {
+    free(target->zBuffer);
+    free(target->frameBuffer);
+    target->zBuffer = NULL;
+    target->frameBuffer = NULL;
+}
+
+/**
+ * Clear a contiguous span of the buffers of a render target
+ *
+ * @param target Render target to clear
+ * @param offset Offset of the first element of the span
+ * @param count Count of elements (samples) in the span
+ */
+static void clearSpan(const RenderTarget* target, size_t offset, size_t count) {
+    clearDepth((unsigned char*)target->zBuffer + offset * depthFormatSize(target->depthFormat), target->depthFormat, count, target->farClipping);
+
+    // Depth only targets do not have any colors
+    if (!target->frameBuffer)
+        return;
+
+    // Gray values are stored in every color channel, only the alpha channel differs from the background
+    if (target->colorFormat == COLOR_FORMAT_RGBA8) {
+        unsigned int pixel = packGray(target->backgroundColor);
+        unsigned int* frameBuffer = (unsigned int*)target->frameBuffer + offset;
+        for (size_t i = 0; i < count; ++i) { frameBuffer[i] = pixel; }
+    }
+    else {
+        unsigned int pixelSize = colorFormatSize(target->colorFormat);
+        memset(target->frameBuffer + offset * pixelSize, target->backgroundColor, count * pixelSize);
+    }
+}
+
+void clearRenderTarget(const RenderTarget* target) {
+    clearRenderTargetRect(target, NULL);
+}
+
+void clearRenderTargetRect(const RenderTarget* target, const Rect* rect) {
+    unsigned int samples = targetSamples(target);
+
+    // The complete target is cleared at once, including the padding of tiled targets
+    if (!rect) {
+        clearSpan(target, 0, renderTargetPixelCount(target) * samples);
+        return;
+    }
+
+    Bounds bounds = targetBounds(target, rect);
+    unsigned int shift = tileShift(target);
+
+    // Every tile stores a contiguous part of a row, linear targets store the complete row
+    for (int y = bounds.minY; y <= bounds.maxY; ++y) {
+        size_t row = rowOffset(target, y);
+
+        for (int x = bounds.minX; x <= bounds.maxX;) {
+            int end = shift ? MIN(bounds.maxX, (((x >> shift) + 1) << shift) - 1) : bounds.maxX;
+            clearSpan(target, (row + columnOffset(shift, x)) * samples, (size_t)(end - x + 1) * samples);
+            x = end + 1;
+        }
+    }
+}
+
+/**
+ * Resolve the samples of a span of pixels of a multisampled render target
+ *
+ * @param target Render target to resolve
+ * @param offset Offset of the first pixel of the span in pixels
+ * @param count Count of pixels in the span
+ * @param frameBuffer Destination of the averaged colors of the span, NULL to skip
+ * @param zBuffer Destination of the closest depths of the span, NULL to skip
+ */
+static void resolveSamples(const RenderTarget* target, size_t offset, unsigned int count, unsigned char* frameBuffer, float* zBuffer) {
+    unsigned int pixelSize = colorFormatSize(target->colorFormat);
+    unsigned int samples = targetSamples(target);
+    DepthRange range = targetDepthRange(target);
+
+    for (unsigned int i = 0; i < count; ++i) {
+        size_t first = (offset + i) * samples;
+
+        if (frameBuffer) {
+            const unsigned char* source = target->frameBuffer + first * pixelSize;
+            for (unsigned int k = 0; k < pixelSize; ++k) {
+                unsigned int sum = samples / 2;
+                for (unsigned int s = 0; s < samples; ++s) { sum += source[s * pixelSize + k]; }
+                frameBuffer[i * pixelSize + k] = (unsigned char)(sum / samples);
+            }
+        }
+
+        if (zBuffer) {
+            float depth = loadDepth(target->zBuffer, target->depthFormat, first, &range);
+            for (unsigned int s = 1; s < samples; ++s) { depth = MIN(depth, loadDepth(target->zBuffer, target->depthFormat, first + s, &range)); }
+            zBuffer[i] = depth;
+        }
+    }
+}
+
+void resolveRenderTarget(const RenderTarget* target, unsigned char* frameBuffer, float* zBuffer) {
+    unsigned int pixelSize = colorFormatSize(target->colorFormat);
+    if (!target->frameBuffer)
+        frameBuffer = NULL;
+    unsigned int shift = tileShift(target);
+    unsigned int width = target->width;
+    DepthRange range = targetDepthRange(target);
+
+    // Every tile stores a contiguous part of a row, linear targets store the complete row
+    unsigned int step = shift ? 1u << shift : width;
+
+    for (unsigned int y = 0; y < target->height; ++y) {
+        size_t row = rowOffset(target, (int)y);
+
+        for (unsigned int x = 0; x < width; x += step) {
+            size_t offset = row + columnOffset(shift, (int)x);
+            unsigned int count = MIN(width - x, step);
+
+            if (targetSamples(target) > 1) {
+                resolveSamples(target, offset, count,
+                    frameBuffer ? frameBuffer + ((size_t)y * width + x) * pixelSize : NULL,
+                    zBuffer ? zBuffer + (size_t)y * width + x : NULL);
+                continue;
+            }
+
+            if (frameBuffer)
+                memcpy(frameBuffer + ((size_t)y * width + x) * pixelSize, target->frameBuffer + offset * pixelSize, count * pixelSize);
+            if (zBuffer) {
+                for (unsigned int i = 0; i < count; ++i) {
+                    zBuffer[(size_t)y * width + x + i] = loadDepth(target->zBuffer, target->depthFormat, offset + i, &range);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Execute the jobs of a stage on the threads of a frame, see parallelFor
+ *
+ * @param frame Frame which is drawn, passed to every job
+ * @param jobCount Count of jobs to execute
+ * @param job Job to execute
+ */
+static void runJobs(Frame* frame, unsigned int jobCount, ParallelJob job) {
+    if (frame->pool)
+        parallelForPool(frame->pool, jobCount, job, frame);
+    else
+        parallelFor(jobCount, frame->threadCount, job, frame);
+}
+
+/**
+ * Release all buffers of a frame storage
+ *
+ * @param storage Storage to release
+ */
+static void freeFrameStorage(FrameStorage* storage) {
+    for (unsigned int i = 0; i < storage->batchCount; ++i) {
+        SetupBatch* batch = &storage->batches[i];
+        free(batch->triangles);
+        free(batch->planes);
+        free(batch->clipCamera);
+        free(batch->clipRaster);
+        free(batch->bin.data);
+        free(batch->cursors.data);
+    }
+
+    Buffer* buffers[] = {
+        &storage->vertexOffsets, &storage->triangleOffsets, &storage->camera, &storage->raster, &storage->varyings,
+        &storage->binOffsets, &storage->bins, &storage->tileColors, &storage->tileDepths, &storage->threadStats,
+        &storage->querySamples
+    };
+    for (unsigned int i = 0; i < sizeof(buffers) / sizeof(buffers[0]); ++i) { free(buffers[i]->data); }
+
+    free(storage->batches);
+    memset(storage, 0, sizeof(FrameStorage));
+}
+
+/**
+ * Transform and set up the triangles of all instances of a draw list, see drawInstances
+ *
+ * @param frame Frame to initialize, must be released using endFrame when the setup succeeded
+ * @param target Render target to draw into, or the image of a streamed draw
+ * @param drawList Instances to draw
+ * @param colored Non zero when the target has colors, otherwise the triangles are drawn depth only
+ * @return Zero when nothing has to be drawn (empty target or scissor rectangle), otherwise non zero
+ */
+static int beginFrame(Frame* frame, const RenderTarget* target, const DrawList* drawList, int colored) {
+    if (target->width == 0 || target->height == 0)
+        return 0;
+
+    DrawContext* context = drawList->context;
+    *frame = (Frame) {
+        .target = target,
+        .drawList = drawList,
+        .pool = context ? &context->pool : NULL,
+        .threadCount = context ? context->pool.threadCount : drawList->threadCount ? drawList->threadCount : hardwareThreadCount(),
+        .state = drawList->state ? *drawList->state : defaultPipelineState(),
+        .depthRange = targetDepthRange(target)
+    };
+    frame->storage = context ? context->storage : &frame->ownStorage;
+    FrameStorage* storage = frame->storage;
+
+    // Nothing is drawn when the scissor rectangle does not overlap the target
+    frame->scissor = targetBounds(target, frame->state.scissor);
+    if (frame->scissor.minX > frame->scissor.maxX || frame->scissor.minY > frame->scissor.maxY)
+        return 0;
+
+    // Depth only targets are drawn without any shading
+    if (!colored)
+        frame->state.shadeMode = SHADE_MODE_DEPTH_ONLY;
+
+    viewAspect(frame->state.deviceAspect, target->width, target->height, &frame->wAspect, &frame->hAspect);
+
+    // Shadows are only received by shaded triangles
+    const ShadowMap* shadowMap = frame->state.shadowMap;
+    if (shadowMap && shadowMap->target->width > 0 && shadowMap->target->height > 0 && frame->state.shadeMode != SHADE_MODE_DEPTH_ONLY) {
+        frame->shadow.map = shadowMap;
+        frame->shadow.range = targetDepthRange(shadowMap->target);
+        frame->shadow.width = (float)shadowMap->target->width;
+        frame->shadow.height = (float)shadowMap->target->height;
+        viewAspect(shadowMap->deviceAspect, shadowMap->target->width, shadowMap->target->height, &frame->shadow.wAspect, &frame->shadow.hAspect);
+    }
+
+    // Vertices of all instances are stored after each other, shared meshes are transformed per instance
+    frame->vertexOffsets = reserveBuffer(&storage->vertexOffsets, drawList->instanceCount * sizeof(unsigned int));
+    frame->triangleOffsets = reserveBuffer(&storage->triangleOffsets, drawList->instanceCount * sizeof(unsigned int));
+    for (unsigned int i = 0; i < drawList->instanceCount; ++i) {
+        frame->vertexOffsets[i] = frame->vertexCount;
+        frame->triangleOffsets[i] = frame->triangleCount;
+        frame->vertexCount += drawList->instances[i].mesh->vertexCount;
+        frame->triangleCount += drawList->instances[i].mesh->indicesCount / 3;
+    }
+
+    // Attributes are stored using the stride of the instance with the most attributes, depth only and flat shading use none
+    int attributes = frame->state.shadeMode != SHADE_MODE_DEPTH_ONLY && frame->state.shadeMode != SHADE_MODE_FLAT;
+    for (unsigned int i = 0; i < drawList->instanceCount && attributes; ++i) {
+        const Mesh* mesh = drawList->instances[i].mesh;
+        if (mesh->attributes)
+            frame->attributeStride = MAX(frame->attributeStride, MIN(mesh->attributeCount, MAX_ATTRIBUTES));
+    }
+
+    frame->camera = reserveBuffer(&storage->camera, frame->vertexCount * sizeof(Vector3));
+    frame->raster = reserveBuffer(&storage->raster, frame->vertexCount * sizeof(Vector3));
+
+    if (frame->attributeStride > 0)
+        frame->varyings = reserveBuffer(&storage->varyings, (size_t)frame->vertexCount * frame->attributeStride * sizeof(float));
+
+    if (storage->batchCount < frame->threadCount) {
+        storage->batches = realloc(storage->batches, frame->threadCount * sizeof(SetupBatch));
+        memset(storage->batches + storage->batchCount, 0, (frame->threadCount - storage->batchCount) * sizeof(SetupBatch));
+        storage->batchCount = frame->threadCount;
+    }
+
+    // Every setup job starts with storage for the triangles of its slice, which is enough when nothing is clipped
+    frame->batches = storage->batches;
+    for (unsigned int i = 0; i < frame->threadCount; ++i) {
+        SetupBatch* batch = &frame->batches[i];
+        batch->count = 0;
+        batch->clipCount = 0;
+        reserveTriangles(batch, (unsigned int)((unsigned long long)frame->triangleCount * (i + 1) / frame->threadCount
+            - (unsigned long long)frame->triangleCount * i / frame->threadCount), frame->attributeStride);
+    }
+
+    /*
+     * The guard band in camera space: a raster coordinate of -GUARD_BAND or of the image size + GUARD_BAND
+     * is a plane through the camera, the raster position of a point is x * near * wAspect / -z
+     * (resp. y) scaled from -1 .. 1 to the image
+     */
+    float near = target->nearClipping;
+    float guardX = 1 + 2 * (float)GUARD_BAND / (float)target->width;
+    float guardY = 1 + 2 * (float)GUARD_BAND / (float)target->height;
+    float clipPlanes[CLIP_PLANE_COUNT][4] = {
+        { 0, 0, -1, -near },
+        { near * frame->wAspect, 0, -guardX, 0 },
+        { -near * frame->wAspect, 0, -guardX, 0 },
+        { 0, near * frame->hAspect, -guardY, 0 },
+        { 0, -near * frame->hAspect, -guardY, 0 }
+    };
+    memcpy(frame->clipPlanes, clipPlanes, sizeof(clipPlanes));
 
     /*
-     * We test weather the box is completely out side of the raster image dimensions
-     * if this is true we can immediately return
+     * Every thread collects its own counters, the heatmaps are shared as the raster bands
+     * of the threads never write the same pixel
      */
-    if (rMinX > (float)w || rMaxX < 0 || rMinY > (float)h || rMaxY < 0)
+    if (drawList->stats) {
+        frame->threadStats = reserveBuffer(&storage->threadStats, frame->threadCount * sizeof(RasterStats));
+        memset(frame->threadStats, 0, frame->threadCount * sizeof(RasterStats));
+        for (unsigned int i = 0; i < frame->threadCount; ++i) {
+            frame->threadStats[i].touchMap = drawList->stats->touchMap;
+            frame->threadStats[i].depthMap = drawList->stats->depthMap;
+            frame->threadStats[i].shadeMap = drawList->stats->shadeMap;
+        }
+    }
+
+    runJobs(frame, frame->threadCount, transformJob);
+    runJobs(frame, frame->threadCount, setupJob);
+    mergeClipVertices(frame);
+    return 1;
+}
+
+/**
+ * Add the statistics of a frame to the statistics of its draw list and release the frame
+ *
+ * The buffers of a draw context are kept for its next draw.
+ *
+ * @param frame Frame set up using beginFrame
+ */
+static void endFrame(Frame* frame) {
+    const DrawList* drawList = frame->drawList;
+    if (drawList->stats) {
+        RasterStats* stats = drawList->stats;
+        stats->trianglesSubmitted += frame->triangleCount;
+
+        for (unsigned int i = 0; i < frame->threadCount; ++i) { addRasterStats(stats, &frame->threadStats[i]); }
+    }
+
+    if (frame->storage == &frame->ownStorage)
+        freeFrameStorage(&frame->ownStorage);
+}
+
+void createDrawContext(unsigned int threadCount, DrawContext* context) {
+    createThreadPool(threadCount, &context->pool);
+    context->storage = calloc(1, sizeof(FrameStorage));
+}
+
+void freeDrawContext(DrawContext* context) {
+    freeThreadPool(&context->pool);
+    if (context->storage)
+        freeFrameStorage(context->storage);
+    free(context->storage);
+    context->storage = NULL;
+}
+
+void drawInstances(const RenderTarget* target, const DrawList* drawList) {
+    Frame frame;
+    if (!beginFrame(&frame, target, drawList, target->frameBuffer != NULL))
         return;
 
-    // Calculate raster image bounding box
-    int minY = MAX(0, (int)floorf(rMinY));
-    int maxY = MIN(h, (int)floorf(rMaxY));
-    int minX = MAX(0, (int)floorf(rMinX));
-    int maxX = MIN(w, (int)floorf(rMaxX));
+    if (drawList->mode == DRAW_MODE_DIRECT) {
+        unsigned int rows = (unsigned int)(frame.scissor.maxY - frame.scissor.minY + 1);
+        frame.rasterRows = frame.scissor;
+        frame.rasterSurface = (Surface) { target, 0, 0 };
+        frame.bandCount = MIN(rows, frame.threadCount == 1 ? 1 : frame.threadCount * BANDS_PER_THREAD);
+        runJobs(&frame, frame.bandCount, rasterJob);
+    }
+    else {
+        FrameStorage* storage = frame.storage;
+        size_t tilePixels = ((size_t)1 << (TILE_SHIFT * 2)) * targetSamples(target);
+        frame.tilesX = (target->width + (1u << TILE_SHIFT) - 1) >> TILE_SHIFT;
+        frame.tileCount = frame.tilesX * ((target->height + (1u << TILE_SHIFT) - 1) >> TILE_SHIFT);
+        frame.binShiftX = TILE_SHIFT;
+        frame.binShiftY = TILE_SHIFT;
+        frame.binOffsets = reserveBuffer(&storage->binOffsets, (size_t)frame.threadCount * (frame.tileCount + 1) * sizeof(unsigned int));
+        frame.bins = reserveBuffer(&storage->bins, frame.threadCount * sizeof(unsigned int*));
+        if (frame.state.shadeMode != SHADE_MODE_DEPTH_ONLY)
+            frame.tileColors = reserveBuffer(&storage->tileColors, tilePixels * colorFormatSize(target->colorFormat) * frame.threadCount);
+        frame.tileDepths = reserveBuffer(&storage->tileDepths, tilePixels * depthFormatSize(target->depthFormat) * frame.threadCount);
 
-    // Total area of triangle
-    float area = edgeFunction(&r[0], &r[1], &r[2]);
+        runJobs(&frame, frame.threadCount, binJob);
+        runJobs(&frame, frame.tileCount, tileJob);
+    }
 
-    for (int y = minY; y <= maxY; ++y) {
-        for (int x = minX; x <= maxX; ++x) {
-            Vector3 p = { (float)x, (float)y, 0 };
+    endFrame(&frame);
+}
 
-            // Area of each point in the triangle
-            float a[3] = {
-                edgeFunction(&r[1], &r[2], &p),
-                edgeFunction(&r[2], &r[0], &p),
-                edgeFunction(&r[0], &r[1], &p)
-            };
+int drawInstancesStreamed(const RenderTarget* image, const DrawList* drawList, const StripStream* stream) {
+    if (image->width == 0 || image->height == 0)
+        return 1;
 
-            /*
-             * We check if the pixel falls inside of the triangle using the edge function
-             * based on the clockwise winding (CW) order.
-             *
-             * If it does not fall inside of the we continue looping through the box.
-             */
-            if (a[0] < 0 || a[1] < 0 || a[2] < 0)
-                continue;
+    // Strips are bins as wide as the image, a shift of 31 keeps every column in the first bin
+    unsigned int stripShift = 0;
+    unsigned int stripHeight = stream->stripHeight ? stream->stripHeight : STRIP_HEIGHT;
+    while ((1u << stripShift) < MIN(stripHeight, image->height) && stripShift < 31) { stripShift++; }
+    stripHeight = MIN(1u << stripShift, image->height);
+    unsigned int stripCount = (unsigned int)(((unsigned long long)image->height + (1u << stripShift) - 1) >> stripShift);
 
-            // Interpolate bary centric coordinate area
-            a[0] /= area;
-            a[1] /= area;
-            a[2] /= area;
+    // The buffers of a single strip are reused for all strips, together with the resolved rows of the strip
+    ColorFormat colorFormat = image->colorFormat;
+    RenderTarget strip = createRenderTarget(image->width, stripHeight, colorFormat, image->depthFormat, TARGET_LAYOUT_LINEAR, image->sampleCount, image->backgroundColor);
+    strip.nearClipping = image->nearClipping;
+    strip.farClipping = image->farClipping;
 
-            /*
-             * We use the (raster vector) z component we stored inside the raster vectors earlier to check if the pixel is
-             * overlapped by an other pixel using the z-buffer algorithm.
-             *
-             * If the z component is overlapped we do not have to render this pixel as it is not visible on the screen.
-             * Otherwise if the z component is overlapping the old value we store the new z component and compute the screen pixel
-             */
-            float z = 1 / (r[0].z * a[0] + r[1].z * a[1] + r[2].z * a[2]);
-            if (z >= zBuffer[y * width + x])
-                continue;
+    size_t stripPixels = (size_t)image->width * stripHeight;
+    unsigned char* pixels = colorFormat != COLOR_FORMAT_NONE ? malloc(stripPixels * colorFormatSize(colorFormat)) : NULL;
+    float* depths = stream->resolveDepth ? malloc(stripPixels * sizeof(float)) : NULL;
+
+    // Nothing but the background is streamed when no triangle can be drawn
+    Frame frame;
+    int drawn = beginFrame(&frame, image, drawList, colorFormat != COLOR_FORMAT_NONE);
+    if (drawn) {
+        frame.tilesX = 1;
+        frame.tileCount = stripCount;
+        frame.binShiftX = 31;
+        frame.binShiftY = stripShift;
+        frame.binOffsets = reserveBuffer(&frame.storage->binOffsets, (size_t)frame.threadCount * (frame.tileCount + 1) * sizeof(unsigned int));
+        frame.bins = reserveBuffer(&frame.storage->bins, frame.threadCount * sizeof(unsigned int*));
+        runJobs(&frame, frame.threadCount, binJob);
+    }
+
+    int result = 1;
+    for (unsigned int i = 0; i < stripCount && result; ++i) {
+        unsigned int y = i << stripShift;
+        strip.height = MIN(stripHeight, image->height - y);
+        clearRenderTarget(&strip);
+
+        // Strips are split into bands like direct draws, only the rows inside of the scissor rectangle are drawn
+        if (drawn) {
+            frame.strip = i;
+            frame.rasterRows = frame.scissor;
+            frame.rasterRows.minY = MAX(frame.scissor.minY, (int)y);
+            frame.rasterRows.maxY = MIN(frame.scissor.maxY, (int)(y + strip.height) - 1);
+            frame.rasterSurface = (Surface) { &strip, 0, (int)y };
+
+            if (frame.rasterRows.minY <= frame.rasterRows.maxY) {
+                unsigned int rows = (unsigned int)(frame.rasterRows.maxY - frame.rasterRows.minY + 1);
+                frame.bandCount = MIN(rows, frame.threadCount == 1 ? 1 : frame.threadCount * BANDS_PER_THREAD);
+                runJobs(&frame, frame.bandCount, rasterJob);
+            }
+        }
+
+        resolveRenderTarget(&strip, pixels, depths);
+        result = stream->writer(stream->context, pixels, depths, y, strip.height);
+    }
 
-            zBuffer[y * width + x] = z;
-            frameBuffer[y * width + x] = abs(backgroundColor - getPixelShade(z, c, a));
+    if (drawn)
+        endFrame(&frame);
+
+    free(pixels);
+    free(depths);
+    freeRenderTarget(&strip);
+    return result;
+}
+
+unsigned long long queryOcclusion(const RenderTarget* target, const DrawList* drawList) {
+    Frame frame;
+    if (!beginFrame(&frame, target, drawList, 0))
+        return 0;
+
+    // The triangles are tested like a direct draw, every thread counts the samples of its bands
+    unsigned int rows = (unsigned int)(frame.scissor.maxY - frame.scissor.minY + 1);
+    frame.rasterRows = frame.scissor;
+    frame.rasterSurface = (Surface) { target, 0, 0 };
+    frame.bandCount = MIN(rows, frame.threadCount == 1 ? 1 : frame.threadCount * BANDS_PER_THREAD);
+    frame.querySamples = reserveBuffer(&frame.storage->querySamples, frame.threadCount * sizeof(unsigned long long));
+    memset(frame.querySamples, 0, frame.threadCount * sizeof(unsigned long long));
+    runJobs(&frame, frame.bandCount, rasterJob);
+
+    unsigned long long visible = 0;
+    for (unsigned int i = 0; i < frame.threadCount; ++i) { visible += frame.querySamples[i]; }
+
+    endFrame(&frame);
+    return visible;
+}
+
+unsigned long long queryBoxOcclusion(
+        const RenderTarget* target,
+        const Vector3* boxMin,
+        const Vector3* boxMax,
+        const Matrix4x4* modelViewProjection,
+        const PipelineState* state,
+        unsigned int threadCount) {
+
+    // Corner i uses the maximum of x, y and z when bit 0, 1 and 2 are set, the faces are counter clockwise from outside
+    static const unsigned int faces[6][4] = {
+        { 0, 4, 6, 2 }, { 1, 3, 7, 5 }, { 0, 1, 5, 4 }, { 2, 6, 7, 3 }, { 0, 2, 3, 1 }, { 4, 5, 7, 6 }
+    };
+
+    Vector3 corners[8];
+    unsigned int behind = 0;
+    for (unsigned int i = 0; i < 8; ++i) {
+        corners[i] = (Vector3) { i & 1 ? boxMax->x : boxMin->x, i & 2 ? boxMax->y : boxMin->y, i & 4 ? boxMax->z : boxMin->z };
+        Vector3 camera = transformVec3(&corners[i], modelViewProjection);
+        behind += camera.z > -target->nearClipping;
+    }
+
+    if (behind == 8)
+        return 0;
+
+    // The clipped faces of a box crossing the near clipping plane do not cover it, it is reported as fully visible
+    if (behind > 0) {
+        Bounds bounds = targetBounds(target, state ? state->scissor : NULL);
+        if (bounds.minX > bounds.maxX || bounds.minY > bounds.maxY)
+            return 0;
+        return (unsigned long long)(bounds.maxX - bounds.minX + 1) * (unsigned long long)(bounds.maxY - bounds.minY + 1) * targetSamples(target);
+    }
+
+    // Mirroring matrices turn the faces inside out, their winding is reversed
+    Vector3 axisX = { modelViewProjection->p1.x, modelViewProjection->p1.y, modelViewProjection->p1.z };
+    Vector3 axisY = { modelViewProjection->p2.x, modelViewProjection->p2.y, modelViewProjection->p2.z };
+    Vector3 axisZ = { modelViewProjection->p3.x, modelViewProjection->p3.y, modelViewProjection->p3.z };
+    Vector3 axisXY = crossVec3(&axisX, &axisY);
+    int mirrored = dotVec3(&axisXY, &axisZ) < 0;
+
+    unsigned int indices[36];
+    for (unsigned int i = 0; i < 6; ++i) {
+        const unsigned int* face = faces[i];
+        unsigned int triangles[2][3] = { { face[0], face[1], face[2] }, { face[0], face[2], face[3] } };
+
+        // Indices are one-based
+        for (unsigned int t = 0; t < 2; ++t) {
+            unsigned int* triangle = indices + i * 6 + t * 3;
+            triangle[0] = triangles[t][0] + 1;
+            triangle[1] = triangles[t][mirrored ? 2 : 1] + 1;
+            triangle[2] = triangles[t][mirrored ? 1 : 2] + 1;
         }
     }
+
+    Mesh box = { corners, 8, indices, 36 };
+    Instance instance = { &box, *modelViewProjection };
+    DrawList drawList = { &instance, 1, threadCount, NULL, DRAW_MODE_DIRECT, state };
+    return queryOcclusion(target, &drawList);
 }
 
 void rasterize(
@@ -156,39 +2789,24 @@ void rasterize(
         unsigned int width,
         unsigned int height) {
 
-    unsigned int size = width * height;
-    memset(frameBuffer, backgroundColor, size * sizeof(unsigned char));
-    for (int i = 0; i < size; ++i) { zBuffer[i] = FAR_CLIPPING; }
-
-    float fW = (float)width;
-    float fH = (float)height;
-
-    float deviceAspect = DEVICE_ASPECT;
-    float frameAspect = fW / fH;
-
-    float wAspect = 1;
-    float hAspect = 1;
-
-    if (deviceAspect > frameAspect) {
-        hAspect *= frameAspect / deviceAspect;
-    }
-    else {
-        wAspect *= deviceAspect / frameAspect;
-    }
+    RenderTarget target = {
+        .zBuffer = zBuffer,
+        .frameBuffer = frameBuffer,
+        .backgroundColor = backgroundColor,
+        .width = width,
+        .height = height,
+        .nearClipping = NEAR_CLIPPING,
+        .farClipping = FAR_CLIPPING
+    };
 
-    for (int i = 0; i < indicesCount; i+=3) {
-        Vector3 c[3] = {
-            transformVec3(vertices + (indices[i]-1), modelViewProjection),
-            transformVec3(vertices + (indices[i+1]-1), modelViewProjection),
-            transformVec3(vertices + (indices[i+2]-1), modelViewProjection)
-        };
+    // The vertex count is not part of the arguments, the highest index references the last vertex
+    unsigned int vertexCount = 0;
+    for (unsigned int i = 0; i < indicesCount; ++i) { vertexCount = MAX(vertexCount, indices[i]); }
 
-        Vector3 r[3] = {
-            cameraToRaster(&c[0], fW, fH, wAspect, hAspect),
-            cameraToRaster(&c[1], fW, fH, wAspect, hAspect),
-            cameraToRaster(&c[2], fW, fH, wAspect, hAspect)
-        };
+    Mesh mesh = { (Vector3*)vertices, vertexCount, (unsigned int*)indices, indicesCount };
+    Instance instance = { &mesh, *modelViewProjection };
+    DrawList drawList = { &instance, 1, 1 };
 
-        rasterizeTriangle(c, r, zBuffer, frameBuffer, backgroundColor, width, height);
-    }
+    clearRenderTarget(&target);
+    drawInstances(&target, &drawList);
 }
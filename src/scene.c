@@ -0,0 +1,216 @@
+#include <math.h>
+#include <stdlib.h>
+#include "include/scene.h"
+
+/**
+ * Compute the bounding box of the vertices of a mesh
+ *
+ * @param mesh Mesh with at least one vertex
+ * @param boxMin Destination of the smallest coordinates
+ * @param boxMax Destination of the largest coordinates
+ */
+static void meshBox(const Mesh* mesh, Vector3* boxMin, Vector3* boxMax) {
+    *boxMin = mesh->vertices[0];
+    *boxMax = mesh->vertices[0];
+
+    for (unsigned int i = 1; i < mesh->vertexCount; ++i) {
+        const Vector3* v = &mesh->vertices[i];
+        *boxMin = (Vector3) { MIN(boxMin->x, v->x), MIN(boxMin->y, v->y), MIN(boxMin->z, v->z) };
+        *boxMax = (Vector3) { MAX(boxMax->x, v->x), MAX(boxMax->y, v->y), MAX(boxMax->z, v->z) };
+    }
+}
+
+/**
+ * Check if a rectangle contains no pixels
+ *
+ * @param rect Rectangle to check
+ * @return Non zero when the rectangle is empty
+ */
+static int emptyRect(const Rect* rect) {
+    return rect->width == 0 || rect->height == 0;
+}
+
+/**
+ * Compute the smallest rectangle containing two rectangles, empty rectangles are ignored
+ *
+ * @param a First rectangle
+ * @param b Second rectangle
+ * @return Rectangle containing both
+ */
+static Rect unionRect(const Rect* a, const Rect* b) {
+    if (emptyRect(a))
+        return *b;
+    if (emptyRect(b))
+        return *a;
+
+    unsigned int x = MIN(a->x, b->x);
+    unsigned int y = MIN(a->y, b->y);
+    unsigned int maxX = MAX(a->x + a->width, b->x + b->width);
+    unsigned int maxY = MAX(a->y + a->height, b->y + b->height);
+    return (Rect) { x, y, maxX - x, maxY - y };
+}
+
+/**
+ * Compute the intersection of two rectangles
+ *
+ * @param a First rectangle
+ * @param b Second rectangle
+ * @return Pixels inside of both rectangles, empty when they do not overlap
+ */
+static Rect intersectRect(const Rect* a, const Rect* b) {
+    unsigned long long x = MAX(a->x, b->x);
+    unsigned long long y = MAX(a->y, b->y);
+    unsigned long long maxX = MIN((unsigned long long)a->x + a->width, (unsigned long long)b->x + b->width);
+    unsigned long long maxY = MIN((unsigned long long)a->y + a->height, (unsigned long long)b->y + b->height);
+
+    if (x >= maxX || y >= maxY)
+        return (Rect) { 0 };
+    return (Rect) { (unsigned int)x, (unsigned int)y, (unsigned int)(maxX - x), (unsigned int)(maxY - y) };
+}
+
+/**
+ * Compute the pixels an instance could cover, using the projected corners of the bounding box of its mesh
+ *
+ * @param scene Scene of the instance
+ * @param retained Draw state of the instance, its bounding box is updated when the mesh changed
+ * @param instance Instance to project
+ * @param rect Destination of the covered pixels
+ * @return Zero when the instance does not cover any pixel of the target, otherwise non zero
+ */
+static int rasterBounds(const RetainedScene* scene, RetainedInstance* retained, const Instance* instance, Rect* rect) {
+    const RenderTarget* target = scene->target;
+    const Mesh* mesh = instance->mesh;
+    if (!mesh || mesh->vertexCount == 0 || mesh->indicesCount == 0)
+        return 0;
+
+    if (retained->boxMesh != mesh) {
+        meshBox(mesh, &retained->boxMin, &retained->boxMax);
+        retained->boxMesh = mesh;
+    }
+
+    float fW = (float)target->width;
+    float fH = (float)target->height;
+
+    float wAspect;
+    float hAspect;
+    viewAspect(scene->drawList.state ? scene->drawList.state->deviceAspect : DEVICE_ASPECT, target->width, target->height, &wAspect, &hAspect);
+
+    float near = target->nearClipping;
+    float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+
+    for (unsigned int i = 0; i < 8; ++i) {
+        Vector3 corner = {
+            i & 1 ? retained->boxMax.x : retained->boxMin.x,
+            i & 2 ? retained->boxMax.y : retained->boxMin.y,
+            i & 4 ? retained->boxMax.z : retained->boxMin.z
+        };
+        Vector3 camera = transformVec3(&corner, &instance->modelViewProjection);
+
+        // Clipped triangles can cover any pixel
+        if (-camera.z <= near) {
+            *rect = (Rect) { 0, 0, target->width, target->height };
+            return 1;
+        }
+
+        Vector3 raster = cameraToRaster(&camera, fW, fH, wAspect, hAspect, near);
+        minX = MIN(minX, raster.x);
+        minY = MIN(minY, raster.y);
+        maxX = MAX(maxX, raster.x);
+        maxY = MAX(maxY, raster.y);
+    }
+
+    // Pixels are sampled at integer coordinates, a margin of one pixel covers rounding and the sample offsets
+    minX = floorf(minX) - 1;
+    minY = floorf(minY) - 1;
+    maxX = ceilf(maxX) + 1;
+    maxY = ceilf(maxY) + 1;
+
+    if (maxX < 0 || maxY < 0 || minX >= fW || minY >= fH)
+        return 0;
+
+    unsigned int x = (unsigned int)MAX(minX, 0);
+    unsigned int y = (unsigned int)MAX(minY, 0);
+    *rect = (Rect) { x, y, (unsigned int)MIN(maxX, fW - 1) - x + 1, (unsigned int)MIN(maxY, fH - 1) - y + 1 };
+    return 1;
+}
+
+void createRetainedScene(const RenderTarget* target, const DrawList* drawList, RetainedScene* scene) {
+    scene->target = target;
+    scene->drawList = *drawList;
+    scene->retained = calloc(MAX(1, drawList->instanceCount), sizeof(RetainedInstance));
+    scene->valid = 0;
+}
+
+void freeRetainedScene(RetainedScene* scene) {
+    free(scene->retained);
+    scene->retained = NULL;
+    scene->valid = 0;
+}
+
+void markInstanceDirty(RetainedScene* scene, unsigned int instance) {
+    if (instance < scene->drawList.instanceCount)
+        scene->retained[instance].dirty = 1;
+}
+
+void invalidateRetainedScene(RetainedScene* scene) {
+    scene->valid = 0;
+}
+
+int drawRetainedScene(RetainedScene* scene, Rect* redrawn) {
+    const RenderTarget* target = scene->target;
+    const PipelineState* sceneState = scene->drawList.state;
+    Rect full = { 0, 0, target->width, target->height };
+    Rect limit = sceneState && sceneState->scissor ? intersectRect(&full, sceneState->scissor) : full;
+    Rect dirty = { 0 };
+
+    // The pixels of a moved instance have to be redrawn at its previous and at its new position
+    for (unsigned int i = 0; i < scene->drawList.instanceCount; ++i) {
+        RetainedInstance* retained = &scene->retained[i];
+        if (scene->valid && !retained->dirty)
+            continue;
+
+        Rect bounds = { 0 };
+        int visible = rasterBounds(scene, retained, &scene->drawList.instances[i], &bounds);
+        if (retained->visible)
+            dirty = unionRect(&dirty, &retained->bounds);
+        if (visible)
+            dirty = unionRect(&dirty, &bounds);
+
+        retained->bounds = bounds;
+        retained->visible = visible;
+        retained->dirty = 0;
+    }
+
+    // Whole tiles are redrawn, the rectangle is extended to the tile grid
+    if (!scene->valid) {
+        dirty = full;
+    }
+    else if (!emptyRect(&dirty)) {
+        unsigned int mask = (1u << TILE_SHIFT) - 1;
+        unsigned long long maxX = ((unsigned long long)dirty.x + dirty.width + mask) & ~(unsigned long long)mask;
+        unsigned long long maxY = ((unsigned long long)dirty.y + dirty.height + mask) & ~(unsigned long long)mask;
+        dirty.x &= ~mask;
+        dirty.y &= ~mask;
+        dirty.width = (unsigned int)MIN(maxX - dirty.x, target->width);
+        dirty.height = (unsigned int)MIN(maxY - dirty.y, target->height);
+    }
+
+    dirty = intersectRect(&dirty, &limit);
+    scene->valid = 1;
+    if (redrawn)
+        *redrawn = dirty;
+
+    if (emptyRect(&dirty))
+        return 0;
+
+    // All instances are drawn again, setup culls the instances outside of the redrawn rectangle
+    PipelineState state = sceneState ? *sceneState : defaultPipelineState();
+    state.scissor = &dirty;
+
+    DrawList drawList = scene->drawList;
+    drawList.state = &state;
+
+    clearRenderTargetRect(target, &dirty);
+    drawInstances(target, &drawList);
+    return 1;
+}
@@ -0,0 +1,177 @@
+#include <math.h>
+#include <memory.h>
+#include <stdlib.h>
+#include "include/texture.h"
+
+/**
+ * Spread the lower 16 bits of a value over the even bits of the result
+ *
+ * @param value Value to spread
+ * @return Value with a zero bit inserted above every bit
+ */
+static unsigned int spreadBits(unsigned int value) {
+    value &= 0x0000FFFF;
+    value = (value | (value << 8)) & 0x00FF00FF;
+    value = (value | (value << 4)) & 0x0F0F0F0F;
+    value = (value | (value << 2)) & 0x33333333;
+    value = (value | (value << 1)) & 0x55555555;
+    return value;
+}
+
+/**
+ * Get the index of a texel inside of a Morton ordered level
+ *
+ * @param level Level to index
+ * @param x Column of the texel
+ * @param y Row of the texel
+ * @return Index of the texel
+ */
+static unsigned int texelIndex(const TextureLevel* level, unsigned int x, unsigned int y) {
+    unsigned int mask = (1u << level->squareShift) - 1;
+
+    // Only the coordinate along the longer side can exceed a single square block
+    unsigned int block = (x | y) >> level->squareShift;
+    return (block << (level->squareShift * 2)) | spreadBits(x & mask) | (spreadBits(y & mask) << 1);
+}
+
+/**
+ * Linear interpolation of all four channels of two packed pixels, two channels are interpolated at once
+ *
+ * @param a First pixel
+ * @param b Second pixel
+ * @param t Weight of the second pixel in the range of 0 to 256
+ * @return Interpolated pixel
+ */
+static unsigned int lerpTexel(unsigned int a, unsigned int b, unsigned int t) {
+    unsigned int evenChannels = (((a & 0x00FF00FF) * (256 - t) + (b & 0x00FF00FF) * t) >> 8) & 0x00FF00FF;
+    unsigned int oddChannels = (((a >> 8) & 0x00FF00FF) * (256 - t) + ((b >> 8) & 0x00FF00FF) * t) & 0xFF00FF00;
+    return evenChannels | oddChannels;
+}
+
+/**
+ * Store a linear image as Morton ordered level
+ *
+ * @param pixels Linear packed pixels of the level
+ * @param width Width of the level, a power of two
+ * @param height Height of the level, a power of two
+ * @param level Level to fill
+ */
+static void storeLevel(const unsigned int* pixels, unsigned int width, unsigned int height, TextureLevel* level) {
+    level->width = width;
+    level->height = height;
+    level->squareShift = 0;
+    while ((1u << (level->squareShift + 1)) <= MIN(width, height)) { level->squareShift++; }
+
+    level->texels = malloc((size_t)width * height * sizeof(unsigned int));
+    for (unsigned int y = 0; y < height; ++y) {
+        for (unsigned int x = 0; x < width; ++x) {
+            level->texels[texelIndex(level, x, y)] = pixels[(size_t)y * width + x];
+        }
+    }
+}
+
+int createTexture(const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int channels, Texture* texture) {
+    memset(texture, 0, sizeof(Texture));
+    if (width == 0 || height == 0 || (channels != 1 && channels != 3 && channels != 4))
+        return 0;
+
+    unsigned int levelWidth = 1;
+    unsigned int levelHeight = 1;
+    while (levelWidth < width) { levelWidth <<= 1; }
+    while (levelHeight < height) { levelHeight <<= 1; }
+
+    if (levelWidth > 1u << (TEXTURE_MAX_LEVELS - 1) || levelHeight > 1u << (TEXTURE_MAX_LEVELS - 1))
+        return 0;
+
+    // Resample to power of two dimensions and expand every pixel to RGBA
+    unsigned int* level = malloc((size_t)levelWidth * levelHeight * sizeof(unsigned int));
+    for (unsigned int y = 0; y < levelHeight; ++y) {
+        const unsigned char* row = pixels + (size_t)(y * height / levelHeight) * width * channels;
+
+        for (unsigned int x = 0; x < levelWidth; ++x) {
+            const unsigned char* pixel = row + (size_t)(x * width / levelWidth) * channels;
+            unsigned char rgba[4] = { pixel[0], pixel[0], pixel[0], 255 };
+            if (channels >= 3) {
+                rgba[1] = pixel[1];
+                rgba[2] = pixel[2];
+            }
+            if (channels == 4)
+                rgba[3] = pixel[3];
+
+            memcpy(&level[(size_t)y * levelWidth + x], rgba, sizeof(unsigned int));
+        }
+    }
+
+    storeLevel(level, levelWidth, levelHeight, &texture->levels[texture->levelCount++]);
+
+    // Every level averages 2x2 texels of the previous level, a side of a single texel is not halved
+    while (levelWidth > 1 || levelHeight > 1) {
+        unsigned int nextWidth = MAX(1, levelWidth / 2);
+        unsigned int nextHeight = MAX(1, levelHeight / 2);
+        unsigned int stepX = levelWidth / nextWidth - 1;
+        unsigned int stepY = (levelHeight / nextHeight - 1) * levelWidth;
+        unsigned int* next = malloc((size_t)nextWidth * nextHeight * sizeof(unsigned int));
+
+        for (unsigned int y = 0; y < nextHeight; ++y) {
+            for (unsigned int x = 0; x < nextWidth; ++x) {
+                const unsigned int* source = level + (size_t)y * (levelHeight / nextHeight) * levelWidth + x * (levelWidth / nextWidth);
+                unsigned int top = lerpTexel(source[0], source[stepX], 128);
+                unsigned int bottom = lerpTexel(source[stepY], source[stepY + stepX], 128);
+                next[(size_t)y * nextWidth + x] = lerpTexel(top, bottom, 128);
+            }
+        }
+
+        free(level);
+        level = next;
+        levelWidth = nextWidth;
+        levelHeight = nextHeight;
+        storeLevel(level, levelWidth, levelHeight, &texture->levels[texture->levelCount++]);
+    }
+
+    free(level);
+    return 1;
+}
+
+void freeTexture(Texture* texture) {
+    for (unsigned int i = 0; i < texture->levelCount; ++i) {
+        free(texture->levels[i].texels);
+        texture->levels[i].texels = NULL;
+    }
+    texture->levelCount = 0;
+}
+
+float textureLod(const Texture* texture, float dudx, float dvdx, float dudy, float dvdy) {
+    float width = (float)texture->levels[0].width;
+    float height = (float)texture->levels[0].height;
+
+    // Squared texel footprint of a pixel step along both screen axes, the larger one selects the level
+    float x = dudx * dudx * width * width + dvdx * dvdx * height * height;
+    float y = dudy * dudy * width * width + dvdy * dvdy * height * height;
+    return .5f * log2f(MAX(x, y));
+}
+
+unsigned int sampleTexture(const Texture* texture, float u, float v, float lod) {
+    // The negated comparison also selects the first level for an invalid (NaN) level of detail
+    unsigned int index = !(lod > .5f) ? 0 : MIN(texture->levelCount - 1, (unsigned int)(lod + .5f));
+    const TextureLevel* level = &texture->levels[index];
+
+    float x = (u - floorf(u)) * (float)level->width - .5f;
+    float y = (1 - (v - floorf(v))) * (float)level->height - .5f;
+    float x0 = floorf(x);
+    float y0 = floorf(y);
+
+    // Dimensions are powers of two, wrapping is a mask of the coordinate
+    unsigned int maskX = level->width - 1;
+    unsigned int maskY = level->height - 1;
+    unsigned int tx = (unsigned int)(int)x0 & maskX;
+    unsigned int ty = (unsigned int)(int)y0 & maskY;
+    unsigned int tx1 = (tx + 1) & maskX;
+    unsigned int ty1 = (ty + 1) & maskY;
+
+    unsigned int wx = (unsigned int)((x - x0) * 256);
+    unsigned int wy = (unsigned int)((y - y0) * 256);
+
+    unsigned int top = lerpTexel(level->texels[texelIndex(level, tx, ty)], level->texels[texelIndex(level, tx1, ty)], wx);
+    unsigned int bottom = lerpTexel(level->texels[texelIndex(level, tx, ty1)], level->texels[texelIndex(level, tx1, ty1)], wx);
+    return lerpTexel(top, bottom, wy);
+}
@@ -0,0 +1,290 @@
+#if !defined(_WIN32)
+    #define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdlib.h>
+#include "include/threads.h"
+#include "include/utils.h"
+
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <pthread.h>
+    #include <time.h>
+    #include <unistd.h>
+#endif
+
+typedef struct {
+    ParallelJob job;
+    void* context;
+    unsigned int jobCount;
+    unsigned int threadCount;
+    unsigned int thread;
+} Worker;
+
+/**
+ * Shared state of the threads of a pool
+ *
+ * Every call of parallelForPool stores a worker per thread and increments the generation, which wakes the
+ * threads. Each thread decrements the pending count once it finished its worker. The threads receive their
+ * PoolThread argument from the threads array.
+ */
+typedef struct {
+#if defined(_WIN32)
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE started;
+    CONDITION_VARIABLE finished;
+    HANDLE* handles;
+#else
+    pthread_mutex_t lock;
+    pthread_cond_t started;
+    pthread_cond_t finished;
+    pthread_t* handles;
+#endif
+    Worker* workers;
+    void* threads;
+    unsigned int generation;
+    unsigned int pending;
+    int stopped;
+} PoolState;
+
+/**
+ * Argument of a pool thread
+ */
+typedef struct {
+    PoolState* state;
+    unsigned int thread;
+} PoolThread;
+
+static void runWorker(const Worker* worker) {
+    for (unsigned int i = worker->thread; i < worker->jobCount; i += worker->threadCount) {
+        worker->job(worker->context, i, worker->thread);
+    }
+}
+
+#if defined(_WIN32)
+    #define lockPool(state) EnterCriticalSection(&(state)->lock)
+    #define unlockPool(state) LeaveCriticalSection(&(state)->lock)
+    #define waitPool(state, condition) SleepConditionVariableCS(&(state)->condition, &(state)->lock, INFINITE)
+    #define wakePool(state, condition) WakeAllConditionVariable(&(state)->condition)
+#else
+    #define lockPool(state) pthread_mutex_lock(&(state)->lock)
+    #define unlockPool(state) pthread_mutex_unlock(&(state)->lock)
+    #define waitPool(state, condition) pthread_cond_wait(&(state)->condition, &(state)->lock)
+    #define wakePool(state, condition) pthread_cond_broadcast(&(state)->condition)
+#endif
+
+/**
+ * Execute the workers of a pool thread until the pool is stopped
+ *
+ * @param thread Thread of the pool
+ */
+static void runPoolThread(const PoolThread* thread) {
+    PoolState* state = thread->state;
+    unsigned int generation = 0;
+
+    lockPool(state);
+    for (;;) {
+        while (state->generation == generation && !state->stopped) { waitPool(state, started); }
+        if (state->stopped)
+            break;
+
+        generation = state->generation;
+        Worker worker = state->workers[thread->thread];
+        unlockPool(state);
+
+        runWorker(&worker);
+
+        lockPool(state);
+        if (--state->pending == 0)
+            wakePool(state, finished);
+    }
+    unlockPool(state);
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI workerEntry(LPVOID worker) {
+    runWorker(worker);
+    return 0;
+}
+
+static DWORD WINAPI poolEntry(LPVOID thread) {
+    runPoolThread(thread);
+    return 0;
+}
+#else
+static void* workerEntry(void* worker) {
+    runWorker(worker);
+    return NULL;
+}
+
+static void* poolEntry(void* thread) {
+    runPoolThread(thread);
+    return NULL;
+}
+#endif
+
+unsigned int hardwareThreadCount(void) {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return MAX(1, (unsigned int)info.dwNumberOfProcessors);
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (unsigned int)count : 1;
+#endif
+}
+
+double timerSeconds(void) {
+#if defined(_WIN32)
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+#endif
+}
+
+void parallelFor(unsigned int jobCount, unsigned int threadCount, ParallelJob job, void* context) {
+    if (threadCount == 0)
+        threadCount = hardwareThreadCount();
+    threadCount = MIN(threadCount, jobCount);
+
+    if (threadCount <= 1) {
+        Worker worker = { job, context, jobCount, 1, 0 };
+        runWorker(&worker);
+        return;
+    }
+
+    Worker* workers = malloc(threadCount * sizeof(Worker));
+#if defined(_WIN32)
+    HANDLE* handles = malloc(threadCount * sizeof(HANDLE));
+#else
+    pthread_t* handles = malloc(threadCount * sizeof(pthread_t));
+#endif
+
+    for (unsigned int i = 0; i < threadCount; ++i) {
+        workers[i] = (Worker) { job, context, jobCount, threadCount, i };
+    }
+
+    // The calling thread executes the jobs of the first worker
+    for (unsigned int i = 1; i < threadCount; ++i) {
+#if defined(_WIN32)
+        handles[i] = CreateThread(NULL, 0, workerEntry, &workers[i], 0, NULL);
+#else
+        pthread_create(&handles[i], NULL, workerEntry, &workers[i]);
+#endif
+    }
+
+    runWorker(&workers[0]);
+
+    for (unsigned int i = 1; i < threadCount; ++i) {
+#if defined(_WIN32)
+        WaitForSingleObject(handles[i], INFINITE);
+        CloseHandle(handles[i]);
+#else
+        pthread_join(handles[i], NULL);
+#endif
+    }
+
+    free(handles);
+    free(workers);
+}
+
+void createThreadPool(unsigned int threadCount, ThreadPool* pool) {
+    *pool = (ThreadPool) { threadCount ? threadCount : hardwareThreadCount(), NULL };
+    if (pool->threadCount <= 1)
+        return;
+
+    PoolState* state = calloc(1, sizeof(PoolState));
+    state->workers = calloc(pool->threadCount, sizeof(Worker));
+    PoolThread* threads = malloc(pool->threadCount * sizeof(PoolThread));
+#if defined(_WIN32)
+    InitializeCriticalSection(&state->lock);
+    InitializeConditionVariable(&state->started);
+    InitializeConditionVariable(&state->finished);
+    state->handles = malloc(pool->threadCount * sizeof(HANDLE));
+#else
+    pthread_mutex_init(&state->lock, NULL);
+    pthread_cond_init(&state->started, NULL);
+    pthread_cond_init(&state->finished, NULL);
+    state->handles = malloc(pool->threadCount * sizeof(pthread_t));
+#endif
+
+    // The calling thread executes the jobs of the first thread
+    for (unsigned int i = 1; i < pool->threadCount; ++i) {
+        threads[i] = (PoolThread) { state, i };
+#if defined(_WIN32)
+        state->handles[i] = CreateThread(NULL, 0, poolEntry, &threads[i], 0, NULL);
+#else
+        pthread_create(&state->handles[i], NULL, poolEntry, &threads[i]);
+#endif
+    }
+
+    state->threads = threads;
+    pool->shared = state;
+}
+
+void freeThreadPool(ThreadPool* pool) {
+    PoolState* state = pool->shared;
+    if (!state)
+        return;
+
+    lockPool(state);
+    state->stopped = 1;
+    wakePool(state, started);
+    unlockPool(state);
+
+    for (unsigned int i = 1; i < pool->threadCount; ++i) {
+#if defined(_WIN32)
+        WaitForSingleObject(state->handles[i], INFINITE);
+        CloseHandle(state->handles[i]);
+#else
+        pthread_join(state->handles[i], NULL);
+#endif
+    }
+
+#if defined(_WIN32)
+    DeleteCriticalSection(&state->lock);
+#else
+    pthread_mutex_destroy(&state->lock);
+    pthread_cond_destroy(&state->started);
+    pthread_cond_destroy(&state->finished);
+#endif
+
+    free(state->handles);
+    free(state->threads);
+    free(state->workers);
+    free(state);
+    pool->shared = NULL;
+}
+
+void parallelForPool(ThreadPool* pool, unsigned int jobCount, ParallelJob job, void* context) {
+    PoolState* state = pool->shared;
+    unsigned int threadCount = MIN(pool->threadCount, jobCount);
+
+    if (!state || threadCount <= 1) {
+        Worker worker = { job, context, jobCount, 1, 0 };
+        runWorker(&worker);
+        return;
+    }
+
+    // Threads without jobs of their own still take part, which keeps the completion count simple
+    lockPool(state);
+    for (unsigned int i = 0; i < pool->threadCount; ++i) {
+        state->workers[i] = (Worker) { job, context, i < threadCount ? jobCount : 0, threadCount, i };
+    }
+    state->pending = pool->threadCount - 1;
+    state->generation++;
+    wakePool(state, started);
+    unlockPool(state);
+
+    runWorker(&state->workers[0]);
+
+    lockPool(state);
+    while (state->pending > 0) { waitPool(state, finished); }
+    unlockPool(state);
+}